@@ -0,0 +1,251 @@
+// `benchmark` measures the throughput of the three phases of solving a layered
+// graph -- parsing, relaxation, and path extraction -- over a matrix of
+// randomly generated graphs. Run it using `make bench`.
+//
+// Each generated graph has a fixed number of layers, and each layer has the
+// same number of vertices (the "width"). Each vertex has the same number of
+// inward edges (the "fan-in") from random vertices of the previous layer, and
+// edge weights are normally distributed. In a dense graph, the fan-in is the
+// width, and each layer is complete bipartite.
+//
+// Each phase is run `BENCH_REPEAT` times (3 by default), and the fastest run
+// is reported. Relaxation uses `THREADS` threads (1 by default), and
+// `COMPACT_PATHS=1` measures `CompactPath`s instead of `Path`s.
+// `WEIGHT_TYPE` is the type of the edge weights, as for `shortestpath`: with
+// "float", they're rounded to `float`, and with "int", to integers.
+//
+// The columns of the output are:
+//
+// - layers, width, fan-in, edges: the shape of the graph (fan-in is "dense"
+//   for a dense graph)
+// - parse: edges per second parsed from the text format
+// - relax: edges per second consumed by `cheapest_paths`
+// - extract: milliseconds to copy the optimal paths out of their lists
+// - nodes: path nodes still alive after relaxation, i.e. the ones retained
+// - peak RSS: the most memory the process has used so far, in megabytes
+
+#include "cheapestpaths.h"
+#include "layer.h"
+#include "linereader.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace {
+
+struct Case {
+  int layers;
+  int width;
+  int fan_in;
+  bool dense = false;
+};
+
+// The matrix of graphs to benchmark. The wide cases exercise the parallel
+// relaxation, if `THREADS` allows it.
+const Case cases[] = {
+  {100000, 4, 2},
+  {10000, 10, 3},
+  {1000, 100, 3},
+  {100, 1000, 3},
+  {100, 1000, 30},
+  {10, 10000, 10},
+  {10, 100000, 3},
+  {3, 1000000, 3},
+  {10, 1000, 1000, true},
+};
+
+template <typename Weight>
+using Layers = std::vector<std::vector<BasicEdge<Weight>>>;
+
+template <typename Weight>
+Layers<Weight> generate(const Case& shape, std::mt19937& generator) {
+  std::uniform_int_distribution<int> from{0, shape.width - 1};
+  std::normal_distribution<> weight{5.0, 20.0};
+  const double precision = std::is_integral_v<Weight> ? 1 : 100;
+  Layers<Weight> layers(shape.layers);
+  for (std::vector<BasicEdge<Weight>>& layer : layers) {
+    layer.reserve(std::size_t(shape.width) * shape.fan_in);
+    for (int to = 0; to < shape.width; ++to) {
+      for (int i = 0; i < shape.fan_in; ++i) {
+        layer.push_back(BasicEdge<Weight>{
+          .from = shape.dense ? i : from(generator),
+          .to = to,
+          .weight = Weight(std::round(weight(generator) * precision) / precision)
+        });
+      }
+    }
+  }
+  return layers;
+}
+
+template <typename Weight>
+std::string to_text(const Layers<Weight>& layers) {
+  std::string text;
+  const auto append = [&](auto number, char separator) {
+    char buffer[32];
+    char *const end = std::to_chars(buffer, buffer + sizeof buffer - 1, number).ptr;
+    *end = separator;
+    text.append(buffer, end + 1);
+  };
+  for (const std::vector<BasicEdge<Weight>>& layer : layers) {
+    for (const BasicEdge<Weight>& edge : layer) {
+      append(edge.from, ' ');
+      append(edge.to, ' ');
+      append(edge.weight, '\t');
+    }
+    text.push_back('\n');
+  }
+  return text;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double peak_rss_megabytes() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0; // `ru_maxrss` is in kilobytes on Linux
+}
+
+long integer_option(const char *name, long default_value) {
+  if (const char *raw = std::getenv(name)) {
+    return std::atol(raw);
+  }
+  return default_value;
+}
+
+struct SolveTimes {
+  double relax;
+  double extract;
+  std::size_t nodes;
+};
+
+template <typename Weight>
+std::size_t live_nodes(std::type_identity<BasicPath<Weight>>) {
+  return PoolAllocator<LispyListNode<BasicVertexState<Weight>>>::pool().live();
+}
+
+template <typename Weight>
+std::size_t live_nodes(std::type_identity<BasicCompactPath<Weight>>) {
+  return CompactPathStore::instance().live();
+}
+
+// Return the fastest of `repeat` runs of relaxation and of path extraction
+// over the specified `layers`, using `PathType` for the paths.
+template <typename PathType>
+SolveTimes time_solve(
+    const Layers<typename PathType::value_type::weight_type>& layers,
+    const SolveOptions& options,
+    int repeat) {
+  using Weight = typename PathType::value_type::weight_type;
+  SolveTimes times{.relax = 1e300, .extract = 1e300, .nodes = 0};
+  std::vector<PathType> paths;
+  for (int i = 0; i < repeat; ++i) {
+    paths.clear();
+    const auto start = Clock::now();
+    paths = cheapest_paths<PathType>(
+      BasicVectorLayerIterator<Weight>{layers.begin()},
+      BasicVectorLayerIterator<Weight>{layers.end()},
+      options);
+    times.relax = std::min(times.relax, seconds_since(start));
+  }
+  times.nodes = live_nodes(std::type_identity<PathType>{});
+
+  std::vector<std::vector<int>> extracted;
+  for (int i = 0; i < repeat; ++i) {
+    extracted.clear();
+    const auto start = Clock::now();
+    for (const PathType& path : paths) {
+      std::vector<int>& vertices = extracted.emplace_back();
+      for (const auto& state : path) {
+        vertices.push_back(state.vertex);
+      }
+      std::reverse(vertices.begin(), vertices.end());
+    }
+    times.extract = std::min(times.extract, seconds_since(start));
+  }
+  return times;
+}
+
+// Print a row of the table for each of the `cases`, using `Weight` for the
+// edge weights.
+template <typename Weight>
+void run_cases(const SolveOptions& options, int repeat, bool compact_paths) {
+  std::cout
+    << std::setw(7) << "layers" << std::setw(8) << "width" << std::setw(7) << "fan-in"
+    << std::setw(10) << "edges"
+    << std::setw(13) << "parse (e/s)" << std::setw(13) << "relax (e/s)"
+    << std::setw(13) << "extract (ms)" << std::setw(10) << "nodes"
+    << std::setw(15) << "peak RSS (MB)" << '\n';
+
+  std::mt19937 generator{1337};
+  for (const Case& shape : cases) {
+    const Layers<Weight> layers = generate<Weight>(shape, generator);
+    const std::string text = to_text(layers);
+    const double num_edges = double(shape.layers) * shape.width * shape.fan_in;
+
+    double parse = 1e300;
+    std::vector<BasicEdge<Weight>> parsed;
+    for (int i = 0; i < repeat; ++i) {
+      std::istringstream input{text};
+      const auto start = Clock::now();
+      LineReader lines{input};
+      std::string_view line;
+      while (lines.next_line(line)) {
+        parsed.clear();
+        parse_layer(line, parsed);
+      }
+      parse = std::min(parse, seconds_since(start));
+    }
+
+    const SolveTimes times = compact_paths
+      ? time_solve<BasicCompactPath<Weight>>(layers, options, repeat)
+      : time_solve<BasicPath<Weight>>(layers, options, repeat);
+
+    std::cout
+      << std::setw(7) << shape.layers << std::setw(8) << shape.width
+      << std::setw(7) << (shape.dense ? "dense" : std::to_string(shape.fan_in))
+      << std::setw(10) << std::size_t(num_edges)
+      << std::setprecision(3)
+      << std::setw(13) << num_edges / parse << std::setw(13) << num_edges / times.relax
+      << std::setw(13) << times.extract * 1000 << std::setw(10) << times.nodes
+      << std::setw(15) << peak_rss_megabytes() << std::endl;
+  }
+}
+
+} // namespace
+
+int main() {
+  const int repeat = std::max(1L, integer_option("BENCH_REPEAT", 3));
+  SolveOptions options;
+  options.threads = std::max(1L, integer_option("THREADS", 1));
+  const bool compact_paths = integer_option("COMPACT_PATHS", 0) == 1;
+
+  const std::string_view weight_type = [] {
+    const char *const raw = std::getenv("WEIGHT_TYPE");
+    return std::string_view{raw ? raw : "double"};
+  }();
+  if (weight_type == "int") {
+    run_cases<std::int32_t>(options, repeat, compact_paths);
+  } else if (weight_type == "float") {
+    run_cases<float>(options, repeat, compact_paths);
+  } else {
+    run_cases<double>(options, repeat, compact_paths);
+  }
+}
@@ -0,0 +1,1722 @@
+// `cheapest_paths` finds the minimal weight paths through a layered graph
+// (see `layer.h`), where a path begins at any vertex of the first layer (or
+// at any vertex not reached by the previous layer) and ends at a vertex of the
+// last layer.
+//
+// The graph is consumed one layer at a time, and only the edges that might
+// end up part of a minimal path are retained in memory, as paths that share
+// their common prefixes. The paths are `Path`s by default, or `CompactPath`s
+// on request (see `paths.h`).
+//
+// The type of the paths also determines the type of the edge weights: the
+// edges of a graph solved with `BasicPath<Weight>` or
+// `BasicCompactPath<Weight>` paths are `BasicEdge<Weight>`s. Relaxation adds
+// and compares `TotalWeight<Weight>`s, so with integer weights, it's exact.
+
+#pragma once
+
+#include "checkpoint.h"
+#include "layer.h"
+#include "lispylist.h"
+#include "metrics.h"
+#include "paths.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The dense layer kernel (see `relax_dense`) uses `std::experimental::simd`
+// where it's available, which is as wide as the instruction set that the
+// compiler is told to target (e.g. AVX2 with `-march=haswell`).
+#if __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define CHEAPESTPATHS_SIMD
+#endif
+
+// Diagnostics are written to `debug`, which by default discards them.
+inline std::ostream debug{nullptr};
+
+// How the solver maps the names of vertices (see `Edge`) to the indices of
+// its per-layer arrays (see `SolveOptions::vertex_ids`).
+enum class VertexIds {
+  dense, // a vertex's index is its name
+  sparse, // names get indices in order of appearance (see `VertexIndex`)
+  automatic // dense, until the names of a layer look sparse
+};
+
+struct SolveOptions {
+  // Layers having at least `parallel_min_edges` edges are relaxed using
+  // `threads` threads. Smaller layers aren't worth the overhead, and are
+  // relaxed on the calling thread.
+  int threads = 1;
+  std::size_t parallel_min_edges = 1 << 16;
+
+  // If `on_commit` is set, then every `commit_interval` layers, the solver
+  // checks whether all of the paths it's tracking have merged. If they have,
+  // then the part of the paths before the merge is final: it's passed to
+  // `on_commit`, along with the index of the layer of its first vertex, and
+  // then it's freed. The paths returned by `cheapest_paths` then begin after
+  // the last committed vertex.
+  std::function<void(int first_layer, const std::vector<int>& vertices)> on_commit;
+  int commit_interval = 1;
+
+  // If `stats` is not null, then every `stats_interval` layers, a line of
+  // path node statistics (see `LispyListStats`) is printed to it. This does
+  // nothing unless `LISPYLIST_STATS` is defined.
+  std::ostream *stats = nullptr;
+  int stats_interval = 1000;
+
+  // If `metrics` is not null, then the timings and counts of each layer are
+  // recorded into it (see `LayerMetrics`), except for the time it took to
+  // read, which is up to the caller. This does nothing unless
+  // `SHORTESTPATH_METRICS` is defined.
+  LayerMetrics *metrics = nullptr;
+
+  // If `reclaim_budget` is positive, then paths that are pruned aren't freed
+  // all at once, which can take a while for a long path. Instead, their nodes
+  // are freed incrementally, at the end of each layer, at most
+  // `reclaim_budget` of them or as many as the layer has vertices, whichever
+  // is more. The latter keeps pruned nodes from piling up faster than they're
+  // allocated. See `LispyList::defer_reclamation`.
+  std::size_t reclaim_budget = 0;
+
+  // A layer having at least `dense_min_edges` edges is checked for whether
+  // it's complete bipartite, with its edges listed in order of `from` and
+  // then `to`, or of `to` and then `from`. If it is, then it's relaxed
+  // without the branches and bookkeeping of the general case (see
+  // `DenseOrder`). Zero disables the check.
+  std::size_t dense_min_edges = 1024;
+
+  // With `VertexIds::dense`, the arrays of each layer are as long as the
+  // greatest vertex name in the layer, so one vertex named 2,000,000,000
+  // costs gigabytes. With `VertexIds::sparse`, each name is looked up in a
+  // hash table instead, so the arrays are only as long as the layer has
+  // vertices, but every edge costs two lookups. `VertexIds::automatic`
+  // begins dense, and switches to sparse for the rest of the graph at the
+  // first layer having a vertex named `sparse_min_vertex` or more, and more
+  // than 16 times its number of edges. The results are the same either way.
+  VertexIds vertex_ids = VertexIds::automatic;
+  int sparse_min_vertex = 1 << 16;
+
+  // Beam search trades exactness for bounded work and memory per layer. If
+  // `beam_width` is positive, then once a layer has been relaxed, only the
+  // `beam_width` of its vertices with the least total weight keep their
+  // paths. If `beam_margin` is finite, then only the vertices whose total
+  // weight is within `beam_margin` of the layer's least keep their paths.
+  // The other vertices are pruned: no path continues from them, so their
+  // nodes are freed at once, and the paths that are found might not be
+  // optimal. `CheapestPathsSolver::provably_optimal` tells whether they are.
+  std::size_t beam_width = 0;
+  double beam_margin = std::numeric_limits<double>::infinity();
+
+  // `chunked_cheapest_paths` splits the layers of a graph into `chunks`
+  // chunks of consecutive layers, to be solved on `threads` threads (see
+  // `chunkedpaths.h`). A single chunk is solved as usual.
+  std::size_t chunks = 1;
+};
+
+// Return the total weight that beam search (see `SolveOptions::beam_width`)
+// gives a vertex that it has pruned, so that relaxation passes it over: more
+// than any path costs, but not so much that adding edge weights to it
+// overflows. A pruned vertex differs from one that no edge reached, whose
+// total weight is zero, and at which new paths begin.
+template <typename Total>
+constexpr Total pruned_total_weight() {
+  if constexpr (std::numeric_limits<Total>::has_infinity) {
+    return std::numeric_limits<Total>::infinity();
+  } else {
+    return std::numeric_limits<Total>::max() / 4;
+  }
+}
+
+// `DeferredReclamation` defers the reclamation of `PathType` nodes on the
+// current thread for as long as it exists, if so configured, and then frees
+// whatever is left over.
+template <typename PathType>
+class DeferredReclamation {
+  bool previous;
+  bool enabled;
+
+ public:
+  explicit DeferredReclamation(const SolveOptions& options)
+  : previous(PathType::reclamation_deferred())
+  , enabled(options.reclaim_budget > 0) {
+    if (enabled) {
+      PathType::defer_reclamation(true);
+    }
+  }
+
+  DeferredReclamation(const DeferredReclamation&) = delete;
+  DeferredReclamation& operator=(const DeferredReclamation&) = delete;
+
+  ~DeferredReclamation() {
+    if (enabled) {
+      PathType::defer_reclamation(previous);
+    }
+  }
+};
+
+#ifdef LISPYLIST_STATS
+// `StatsReporter` prints a line of `LispyListStats` every so many layers,
+// including how the counts changed since the previous line.
+class StatsReporter {
+  LispyListStats previous = LispyListStats::instance();
+
+ public:
+  void report(std::ostream& output, int layer, int layers_since) {
+    LispyListStats& current = LispyListStats::instance();
+    output << "layer " << layer
+      << ": live nodes " << current.live
+      << " (peak " << current.peak_live << ")"
+      << ", per layer: allocated " << double(current.allocations - previous.allocations) / layers_since
+      << ", freed " << double(current.frees - previous.frees) / layers_since
+      << ", cascades " << double(current.cascades - previous.cascades) / layers_since
+      << ", longest cascade " << current.longest_cascade << '\n';
+    current.longest_cascade = 0;
+    previous = current;
+  }
+};
+#endif
+
+// Invoke `function(i)` for each `i` in `[0, threads)`, each on its own thread,
+// and wait for them all to finish. `function(0)` runs on the calling thread.
+template <typename Function>
+void run_on_threads(int threads, const Function& function) {
+  std::vector<std::jthread> workers;
+  workers.reserve(threads - 1);
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back(std::cref(function), i);
+  }
+  function(0);
+}
+
+// `ParallelScratch` holds the per-thread buffers used by `relax_in_parallel`,
+// so that they can be reused from one layer to the next.
+template <typename Total>
+struct ParallelScratch {
+  // `costs[thread][to]` is the least total weight to `to` found by `thread`
+  // so far, and `edges[thread][to]` is the index of the edge that achieved
+  // it, or `no_edge` if none has.
+  std::vector<std::vector<Total>> costs;
+  std::vector<std::vector<std::size_t>> edges;
+  static constexpr std::size_t no_edge = -1;
+};
+
+// Update `current_costs` and `current_predecessors` based on the edges in
+// `[edges_begin, edges_end)`, using the specified number of `threads`. The
+// result is the same as that of the serial loop in `cheapest_paths`,
+// including which edge wins a tie (the first one).
+template <typename EdgeIterator, typename Total>
+void relax_in_parallel(
+    EdgeIterator edges_begin,
+    EdgeIterator edges_end,
+    const std::vector<Total>& previous_costs,
+    std::vector<Total>& current_costs,
+    std::vector<int>& current_predecessors,
+    int threads,
+    ParallelScratch<Total>& scratch) {
+  const std::size_t num_edges = edges_end - edges_begin;
+  const std::size_t num_vertices = current_costs.size();
+  scratch.costs.resize(threads);
+  scratch.edges.resize(threads);
+
+  // First, each thread relaxes a contiguous chunk of the edges into its own
+  // scratch arrays, so the threads don't interfere with each other.
+  run_on_threads(threads, [&](int thread) {
+    std::vector<Total>& costs = scratch.costs[thread];
+    std::vector<std::size_t>& edges = scratch.edges[thread];
+    costs.resize(num_vertices);
+    edges.assign(num_vertices, ParallelScratch<Total>::no_edge);
+    const std::size_t begin = num_edges * thread / threads;
+    const std::size_t end = num_edges * (thread + 1) / threads;
+    for (std::size_t i = begin; i != end; ++i) {
+      const auto [from, to, weight] = edges_begin[i];
+      const Total proposed_total = previous_costs[from] + weight;
+      if (edges[to] == ParallelScratch<Total>::no_edge || costs[to] > proposed_total) {
+        costs[to] = proposed_total;
+        edges[to] = i;
+      }
+    }
+  });
+
+  // Then each thread takes a contiguous range of `to` vertices and combines
+  // the results of all of the chunks. Chunks are visited in edge order, and a
+  // later chunk wins only if it's strictly better, so the first edge wins
+  // ties.
+  run_on_threads(threads, [&](int thread) {
+    const std::size_t begin = num_vertices * thread / threads;
+    const std::size_t end = num_vertices * (thread + 1) / threads;
+    for (std::size_t to = begin; to != end; ++to) {
+      Total cost = scratch.costs[0][to];
+      std::size_t edge = scratch.edges[0][to];
+      for (int chunk = 1; chunk < threads; ++chunk) {
+        const std::size_t candidate = scratch.edges[chunk][to];
+        if (candidate != ParallelScratch<Total>::no_edge &&
+            (edge == ParallelScratch<Total>::no_edge || cost > scratch.costs[chunk][to])) {
+          cost = scratch.costs[chunk][to];
+          edge = candidate;
+        }
+      }
+      if (edge != ParallelScratch<Total>::no_edge) {
+        current_costs[to] = cost;
+        current_predecessors[to] = edges_begin[edge].from;
+      }
+    }
+  });
+}
+
+// `DenseScratch` holds the buffers used for dense layers, so that they can be
+// reused from one layer to the next.
+template <typename Weight>
+struct DenseScratch {
+  std::vector<Weight> weights; // of a dense layer given as edges
+  // as total weights, to match the SIMD lanes
+  std::vector<TotalWeight<Weight>> predecessors;
+};
+
+// The orders in which the edges of a complete bipartite layer can be listed
+// and still be relaxed as a dense layer. In either order, the edges into each
+// `to` come in order of `from`, so the first edge that ties for the least cost
+// into a `to` is the one from the least `from`, which is the one that the
+// dense kernels choose.
+enum class DenseOrder {
+  none, // not a dense layer
+  by_from, // by `from`, and then by `to`
+  by_to // by `to`, and then by `from`
+};
+
+// Return the order in which the `num_edges` edges beginning at `edges` would
+// be listed if they were exactly one from each of `from_count` vertices to
+// each of `to_count` vertices, judging by the first two edges, or return
+// `DenseOrder::none` if they can't be. The rest of the edges are checked as
+// they're used.
+template <typename EdgeIterator>
+DenseOrder dense_order(
+    EdgeIterator edges,
+    std::size_t num_edges,
+    std::size_t from_count,
+    std::size_t to_count) {
+  if (num_edges < 2 || num_edges != from_count * to_count) {
+    return DenseOrder::none;
+  }
+  const auto first = edges[0];
+  const auto second = edges[1];
+  if (first.from != 0 || first.to != 0) {
+    return DenseOrder::none;
+  }
+  if (second.from == 0 && second.to == 1) {
+    return DenseOrder::by_from;
+  }
+  if (second.from == 1 && second.to == 0) {
+    return DenseOrder::by_to;
+  }
+  return DenseOrder::none;
+}
+
+// Assign to `weights` the weights of the complete bipartite layer whose edges
+// begin at `edges` and are listed `DenseOrder::by_from`, as a `from_count` by
+// `to_count` matrix (see `relax_dense`). Return `false` if an edge isn't where
+// that order says it is, in which case `weights` is unspecified.
+template <typename EdgeIterator, typename Weight>
+bool dense_weights(
+    EdgeIterator edges,
+    std::size_t from_count,
+    std::size_t to_count,
+    std::vector<Weight>& weights) {
+  weights.resize(from_count * to_count);
+  Weight *const matrix = weights.data();
+  std::size_t misplaced = 0; // nonzero if any edge is misplaced
+  for (std::size_t from = 0, i = 0; from != from_count; ++from) {
+    for (std::size_t to = 0; to != to_count; ++to, ++i) {
+      const BasicEdge<Weight> edge = edges[i];
+      misplaced |= (std::size_t(edge.from) ^ from) | (std::size_t(edge.to) ^ to);
+      matrix[i] = edge.weight;
+    }
+  }
+  return misplaced == 0;
+}
+
+// Relax the edges into the vertices `to` in `[to_begin, to_end)` of the
+// complete bipartite layer whose edges begin at `edges` and are listed
+// `DenseOrder::by_to`, setting `current_costs[to]` and
+// `current_predecessors[to]` as `relax_dense` would. Return `false` if an
+// edge isn't where that order says it is, in which case the costs and
+// predecessors are unspecified.
+//
+// Transposing the edges into a matrix for `relax_dense` costs more than it
+// saves, so instead each `to`'s run of edges is reduced in place. The run is
+// split into `lanes` interleaved parts that are reduced independently and
+// without branches, so that the comparisons don't wait on each other, and
+// then the parts are combined.
+template <typename Weight>
+bool relax_dense_by_to(
+    const BasicEdge<Weight> *edges,
+    std::size_t from_count,
+    const TotalWeight<Weight> *previous_costs,
+    TotalWeight<Weight> *current_costs,
+    int *current_predecessors,
+    std::size_t to_begin,
+    std::size_t to_end) {
+  using Total = TotalWeight<Weight>;
+  constexpr std::size_t lanes = 4;
+  const std::size_t first_lanes = std::min(lanes, from_count);
+  // nonzero if any edge is misplaced
+  std::size_t misplaced = 0;
+  for (std::size_t to = to_begin; to != to_end; ++to) {
+    const BasicEdge<Weight> *const run = edges + to * from_count;
+    Total best[lanes] = {};
+    int best_from[lanes] = {};
+    std::size_t from = 0;
+    for (; from != first_lanes; ++from) {
+      misplaced |= (std::size_t(run[from].from) ^ from) | (std::size_t(run[from].to) ^ to);
+      best[from] = previous_costs[from] + run[from].weight;
+      best_from[from] = int(from);
+    }
+    for (; from + lanes <= from_count; from += lanes) {
+      for (std::size_t lane = 0; lane != lanes; ++lane) {
+        const BasicEdge<Weight>& edge = run[from + lane];
+        misplaced |= (std::size_t(edge.from) ^ (from + lane)) | (std::size_t(edge.to) ^ to);
+        const Total proposed = previous_costs[from + lane] + edge.weight;
+        const bool better = proposed < best[lane];
+        best[lane] = better ? proposed : best[lane];
+        best_from[lane] = better ? int(from + lane) : best_from[lane];
+      }
+    }
+    for (std::size_t lane = 0; from != from_count; ++from, ++lane) {
+      const BasicEdge<Weight>& edge = run[from];
+      misplaced |= (std::size_t(edge.from) ^ from) | (std::size_t(edge.to) ^ to);
+      const Total proposed = previous_costs[from] + edge.weight;
+      const bool better = proposed < best[lane];
+      best[lane] = better ? proposed : best[lane];
+      best_from[lane] = better ? int(from) : best_from[lane];
+    }
+
+    // Each lane holds its first best, so of the lanes that tie, the one with
+    // the least `from` holds the first best overall.
+    Total least = best[0];
+    int least_from = best_from[0];
+    for (std::size_t lane = 1; lane < first_lanes; ++lane) {
+      if (best[lane] < least || (best[lane] == least && best_from[lane] < least_from)) {
+        least = best[lane];
+        least_from = best_from[lane];
+      }
+    }
+    current_costs[to] = least;
+    current_predecessors[to] = least_from;
+  }
+  return misplaced == 0;
+}
+
+// Relax the complete bipartite layer whose edge weights are the `from_count`
+// by `to_count` matrix `weights`, for the vertices `to` in `[to_begin,
+// to_end)`: set `current_costs[to]` to the least `previous_costs[from] +
+// weights[from * to_count + to]` over all `from`, and
+// `current_predecessors[to]` to the least `from` that achieves it.
+// `predecessors` is scratch space of `to_count` elements.
+//
+// The rows of the matrix are visited in order, and each row is combined with
+// the costs so far a vector of `to`s at a time, with no branches.
+//
+// GCC 12 warns, wrongly, that the AVX-512 conversions from `float` and
+// `std::int32_t` weights to their totals may read uninitialized lanes, which
+// would break `make NATIVE=1` under `-Werror`.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+template <typename Weight>
+void relax_dense(
+    const Weight *weights,
+    std::size_t from_count,
+    std::size_t to_count,
+    const TotalWeight<Weight> *previous_costs,
+    TotalWeight<Weight> *current_costs,
+    int *current_predecessors,
+    TotalWeight<Weight> *predecessors,
+    std::size_t to_begin,
+    std::size_t to_end) {
+  using Total = TotalWeight<Weight>;
+  assert(from_count > 0);
+  for (std::size_t to = to_begin; to != to_end; ++to) {
+    current_costs[to] = previous_costs[0] + weights[to];
+    predecessors[to] = 0;
+  }
+  for (std::size_t from = 1; from != from_count; ++from) {
+    const Weight *const row = weights + from * to_count;
+    const Total cost = previous_costs[from];
+    std::size_t to = to_begin;
+#ifdef CHEAPESTPATHS_SIMD
+    namespace stdx = std::experimental;
+    // The weights are converted to totals as they're loaded.
+    using Totals = stdx::native_simd<Total>;
+    for (; to + Totals::size() <= to_end; to += Totals::size()) {
+      const Totals proposed = Totals(row + to, stdx::element_aligned) + cost;
+      Totals best(current_costs + to, stdx::element_aligned);
+      Totals best_from(predecessors + to, stdx::element_aligned);
+      const auto better = proposed < best;
+      stdx::where(better, best) = proposed;
+      stdx::where(better, best_from) = Total(from);
+      best.copy_to(current_costs + to, stdx::element_aligned);
+      best_from.copy_to(predecessors + to, stdx::element_aligned);
+    }
+#endif
+    for (; to != to_end; ++to) {
+      const Total proposed = row[to] + cost;
+      if (proposed < current_costs[to]) {
+        current_costs[to] = proposed;
+        predecessors[to] = Total(from);
+      }
+    }
+  }
+  for (std::size_t to = to_begin; to != to_end; ++to) {
+    current_predecessors[to] = int(predecessors[to]);
+  }
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// `VertexIndex` gives each vertex name that it's asked about the next index,
+// starting from zero, and remembers it. It's an open addressing hash table
+// with linear probing, kept at most half full.
+class VertexIndex {
+  struct Slot {
+    int name; // or -1 if the slot is empty
+    int index;
+  };
+
+  std::vector<Slot> slots; // a power of two of them, or none
+  std::vector<int> by_index; // the name of each index
+  int shift = 32; // 32 less the log2 of `slots.size()`
+
+  std::size_t home(int name) const {
+    // Fibonacci hashing: the high bits of the product depend on all of the
+    // bits of `name`.
+    return std::uint32_t(std::uint32_t(name) * 0x9e3779b9u) >> shift;
+  }
+
+  void grow() {
+    const std::size_t size = slots.empty() ? 16 : slots.size() * 2;
+    slots.assign(size, Slot{.name = -1, .index = 0});
+    shift = 32 - std::countr_zero(size);
+    for (std::size_t index = 0; index != by_index.size(); ++index) {
+      std::size_t slot = home(by_index[index]);
+      while (slots[slot].name >= 0) {
+        slot = (slot + 1) & (size - 1);
+      }
+      slots[slot] = Slot{.name = by_index[index], .index = int(index)};
+    }
+  }
+
+ public:
+  // Return the index of `name`, which must be nonnegative, giving it the next
+  // index if it doesn't have one yet.
+  int insert(int name) {
+    if ((by_index.size() + 1) * 2 > slots.size()) {
+      grow();
+    }
+    const std::size_t mask = slots.size() - 1;
+    for (std::size_t slot = home(name);; slot = (slot + 1) & mask) {
+      Slot& candidate = slots[slot];
+      if (candidate.name == name) {
+        return candidate.index;
+      }
+      if (candidate.name < 0) {
+        candidate = Slot{.name = name, .index = int(by_index.size())};
+        by_index.push_back(name);
+        return candidate.index;
+      }
+    }
+  }
+
+  // Return the index of `name`, or -1 if it doesn't have one.
+  int find(int name) const {
+    if (slots.empty()) {
+      return -1;
+    }
+    const std::size_t mask = slots.size() - 1;
+    for (std::size_t slot = home(name);; slot = (slot + 1) & mask) {
+      if (slots[slot].name == name) {
+        return slots[slot].index;
+      }
+      if (slots[slot].name < 0) {
+        return -1;
+      }
+    }
+  }
+
+  // Return the number of names that have an index.
+  std::size_t size() const {
+    return by_index.size();
+  }
+
+  // Return the name of each index, by index.
+  const std::vector<int>& names() const {
+    return by_index;
+  }
+
+  // Forget all of the names, but keep the memory.
+  void clear() {
+    std::fill(slots.begin(), slots.end(), Slot{.name = -1, .index = 0});
+    by_index.clear();
+  }
+};
+
+// Create a path to each vertex of the current layer that has a predecessor in
+// `current_predecessors`, by prepending to the path of the predecessor in
+// `previous_layer`. A predecessor that has no path yet is where a new path
+// begins, at its cost in `previous_costs` (which is zero, unless the
+// predecessor is in the first layer and has an initial cost). The vertices are
+// indices into the layers, and the names given them in the paths are
+// `previous_names[from]` and `current_names[to]`, or the indices themselves,
+// if the names are null. Return the number of path nodes allocated, which is
+// counted only for `LayerMetrics` (see metrics.h), and is otherwise zero.
+template <typename PathType, typename Total>
+std::size_t extend_paths(
+    std::vector<PathType>& previous_layer,
+    std::vector<PathType>& current_layer,
+    const std::vector<Total>& previous_costs,
+    const std::vector<Total>& current_costs,
+    const std::vector<int>& current_predecessors,
+    const int *previous_names,
+    const int *current_names) {
+  using State = typename PathType::value_type;
+  // `nil` is a handy shorthand for the "empty" or "end" lispy list.
+  const PathType nil;
+  std::size_t allocated = 0;
+  for (std::size_t to = 0; to != current_layer.size(); ++to) {
+    const int from = current_predecessors[to];
+    if (from < 0) {
+      continue;
+    }
+    PathType& path = previous_layer[from];
+    if (path == nil) {
+      const int name = previous_names ? previous_names[from] : from;
+      debug << "    previous vertex " << name << " now has minimum weight " << previous_costs[from] << '\n';
+      path = nil.prepend(State{
+        .least_total_weight_to_here = previous_costs[from],
+        .vertex = name
+      });
+      LAYER_METRIC(++allocated;)
+    }
+    current_layer[to] = path.prepend(State{
+      .least_total_weight_to_here = current_costs[to],
+      .vertex = current_names ? current_names[to] : int(to)
+    });
+    LAYER_METRIC(++allocated;)
+  }
+  return allocated;
+}
+
+// `CommitScratch` holds the buffers used by `commit_merged_prefix`, so that
+// they can be reused from one check to the next.
+template <typename PathType>
+struct CommitScratch {
+  std::vector<PathType> frontier;
+  std::vector<int> vertices;
+};
+
+// If all of the non-empty paths in `layer` share a node, then everything
+// before that node is common to all of them, and so is part of the answer no
+// matter which layers come next. Detach that prefix from the paths, pass its
+// vertices to `on_commit`, and free it. `layer_index` is the index of the
+// layer of vertices whose paths are in `layer`.
+template <typename PathType>
+void commit_merged_prefix(
+    const std::vector<PathType>& layer,
+    int layer_index,
+    const SolveOptions& options,
+    CommitScratch<PathType>& scratch) {
+  std::vector<PathType>& frontier = scratch.frontier;
+  frontier.clear();
+  for (const PathType& path : layer) {
+    if (!path.empty()) {
+      frontier.push_back(path);
+    }
+  }
+  if (frontier.empty()) {
+    return;
+  }
+
+  // Walk all of the paths backwards in lockstep. Each step is one layer back,
+  // and at most one node is ever created per vertex per layer, so paths at a
+  // vertex in common have merged, and from then on only one of them has to be
+  // walked.
+  int node_layer = layer_index;
+  for (;;) {
+    std::sort(frontier.begin(), frontier.end(), [](const PathType& left, const PathType& right) {
+      return left.head().vertex < right.head().vertex;
+    });
+    frontier.erase(std::unique(frontier.begin(), frontier.end()), frontier.end());
+    if (frontier.size() == 1) {
+      break;
+    }
+    for (PathType& path : frontier) {
+      path = path.tail();
+      if (path.empty()) {
+        // A path begins here, and it hasn't merged with the others.
+        return;
+      }
+    }
+    --node_layer;
+  }
+
+  PathType prefix = frontier[0].detach_tail();
+  frontier.clear();
+  if (prefix.empty()) {
+    return; // nothing new since the last commit
+  }
+  std::vector<int>& vertices = scratch.vertices;
+  vertices.clear();
+  for (const auto& state : prefix) {
+    vertices.push_back(state.vertex);
+  }
+  std::reverse(vertices.begin(), vertices.end());
+  debug << "    committed layers " << (node_layer - int(vertices.size())) << " through " << (node_layer - 1) << '\n';
+  options.on_commit(node_layer - int(vertices.size()), vertices);
+}
+
+// `CheapestPathsSolver` is the incremental form of `cheapest_paths`: the
+// layers of a graph are pushed into it one at a time, and it can be asked for
+// the optimal paths through the layers pushed so far. Its buffers are kept
+// from one layer to the next, and from one graph to the next if it's `reset`,
+// so pushing a layer allocates nothing but path nodes, unless the layer is
+// wider than any before it.
+//
+// A solver must be used on one thread, since path nodes belong to the thread
+// that allocated them (see `nodepool.h`). If `options.reclaim_budget` is
+// positive, then the solver defers the reclamation of path nodes on that
+// thread for as long as it exists.
+template <typename PathType = Path>
+class CheapestPathsSolver {
+ public:
+  // the type of the weights of the edges, and of the edges themselves
+  using weight_type = typename PathType::value_type::weight_type;
+  using edge_type = BasicEdge<weight_type>;
+  // the type of the initial and terminal costs of vertices
+  using cost_type = BasicVertexCost<weight_type>;
+  // the type of the total weights of paths, and of initial costs given as
+  // total weights (see `set_initial_totals`)
+  using total_type = TotalWeight<weight_type>;
+  using total_cost_type = BasicVertexCost<total_type>;
+
+ private:
+  using Total = total_type;
+
+  SolveOptions options;
+  DeferredReclamation<PathType> deferred_reclamation;
+  std::vector<PathType> previous_layer;
+  std::vector<PathType> current_layer;
+  // `previous_costs[vertex]` is the least total weight of any path to `vertex`
+  // in the previous layer, or zero if there is no such path (in which case new
+  // paths begin at `vertex`), and likewise for `current_costs`. The costs are
+  // kept apart from the paths, so that relaxing an edge doesn't have to chase
+  // a pointer to the head of a path.
+  std::vector<Total> previous_costs;
+  std::vector<Total> current_costs;
+  // `current_predecessors[vertex]` is the vertex in the previous layer that
+  // precedes `vertex` in the best path found to it so far, or -1 if there is
+  // no path to `vertex`. Paths are extended only once all of a layer's edges
+  // have been relaxed, so that only the winning path to each vertex
+  // allocates a node.
+  std::vector<int> current_predecessors;
+  // If `sparse`, then the vertices of the previous and current layers are
+  // indexed by `previous_index` and `current_index` rather than by name (see
+  // `VertexIds::sparse`), and a layer's edges are relaxed as `sparse_edges`,
+  // which name the vertices by index.
+  bool sparse = false;
+  VertexIndex previous_index;
+  VertexIndex current_index;
+  std::vector<edge_type> sparse_edges;
+  std::vector<int> sparse_froms; // used by `push_dense_layer`
+  std::vector<Total> sparse_costs; // likewise
+  ParallelScratch<Total> parallel_scratch;
+  DenseScratch<weight_type> dense_scratch;
+  CommitScratch<PathType> commit_scratch;
+  // If `beam_pruned`, then beam search has pruned vertices whose paths might
+  // have continued to the current layer, and no such path could cost less
+  // than `beam_bound`: the least total weight of a pruned vertex, plus the
+  // least edge weight of each layer since. `beam_candidates` is scratch
+  // space for `prune_layer`.
+  bool beam_pruned = false;
+  Total beam_bound{};
+  std::vector<int> beam_candidates;
+  // See `set_initial_costs` and `set_terminal_costs`. `terminal_costs` is in
+  // order of vertex, with one cost per vertex.
+  std::vector<total_cost_type> initial_costs;
+  std::vector<cost_type> terminal_costs;
+  LISPYLIST_STAT(StatsReporter stats_reporter;)
+  // When the layer being pushed began, and how many of its edges improved on
+  // the best path to their `to` so far, if they were counted (see
+  // `LayerMetrics::improved_edges`).
+  LAYER_METRIC(std::uint64_t layer_start_ticks = 0;)
+  LAYER_METRIC(std::size_t improved_edges = 0;)
+  LAYER_METRIC(bool improved_edges_counted = false;)
+  int layer_count = 0; // the number of layers pushed so far
+
+  // Switch to `sparse`, if we haven't already and should, given that the
+  // greatest vertex named in the next layer is `max_vertex`, and that the
+  // layer has `num_edges` edges.
+  void choose_vertex_ids(int max_vertex, std::size_t num_edges);
+  // Index the vertices of the previous layer that have paths, and switch to
+  // `sparse`.
+  void switch_to_sparse();
+
+  // Size the buffers for a layer from `from_count` vertices to `to_count`
+  // vertices.
+  void begin_layer(std::size_t from_count, std::size_t to_count);
+  // Size the buffers for the `num_edges` edges `[edges_begin, edges_end)`,
+  // from `from_count` vertices to `to_count` vertices, and relax them.
+  template <typename EdgeIterator>
+  void relax_layer(
+      EdgeIterator edges_begin,
+      EdgeIterator edges_end,
+      std::size_t num_edges,
+      std::size_t from_count,
+      std::size_t to_count);
+  // Relax the layer whose weights are the `from_count` by `to_count` matrix
+  // `weights`, as described by `relax_dense`, where the costs of the `from`
+  // vertices are `from_costs`.
+  void relax_dense_layer(
+      const weight_type *weights,
+      std::size_t from_count,
+      std::size_t to_count,
+      const Total *from_costs);
+  // Relax the layer whose edges begin at `edges` and are listed
+  // `DenseOrder::by_to`, as described by `relax_dense_by_to`. Return `false`
+  // if the layer turns out not to be complete bipartite.
+  bool relax_dense_layer_by_to(const edge_type *edges, std::size_t from_count, std::size_t to_count);
+  // Invoke `relax(to_begin, to_end)` so as to cover all `to_count` vertices
+  // of a layer, on multiple threads if the layer is wide enough.
+  template <typename Relax>
+  void relax_by_to(std::size_t from_count, std::size_t to_count, const Relax& relax);
+
+  // Return whether beam search is enabled (see `SolveOptions::beam_width`).
+  bool beam() const;
+  // Prune the vertices of the relaxed layer that are reached only from pruned
+  // vertices, and then those that fall outside of the beam, if any, given
+  // that the least weight of the layer's `num_edges` edges is `min_weight`.
+  // The vertices of the first layer that have no initial cost count as
+  // pruned (see `set_initial_costs`).
+  void prune_layer(weight_type min_weight, std::size_t num_edges);
+
+  // Invoke `visit(vertex, total_weight)` for each vertex of the last layer
+  // pushed at which a path ends, where `total_weight` includes the vertex's
+  // terminal cost, if any (see `set_terminal_costs`).
+  template <typename Visit>
+  void for_each_end(const Visit& visit) const;
+  // Return the path to `vertex` of the last layer pushed, with
+  // `total_weight` at its head.
+  PathType end_path(int vertex, Total total_weight) const;
+
+  // Extend the paths according to the relaxed layer, and then do whatever
+  // is due at the end of a layer. The layer's edges number `num_edges`, and
+  // the least of their weights is `min_weight`.
+  void finish_layer(weight_type min_weight, std::size_t num_edges);
+
+ public:
+  explicit CheapestPathsSolver(const SolveOptions& options = SolveOptions{});
+
+  // Relax the edges `[edges_begin, edges_end)`, which go from the vertices of
+  // the previous layer to the vertices of a new layer. `EdgeIterator` is a
+  // forward iterator to `edge_type`.
+  template <typename EdgeIterator>
+  void push_layer(EdgeIterator edges_begin, EdgeIterator edges_end);
+  void push_layer(std::span<const edge_type> edges);
+
+  // Relax a complete bipartite layer, whose edge weights are the `from_count`
+  // by `to_count` matrix `weights`, with the weight of the edge from `from` to
+  // `to` at `weights[from * to_count + to]`. This is equivalent to pushing
+  // the layer's edges in order of `from` and then `to`, but faster.
+  void push_dense_layer(std::span<const weight_type> weights, int from_count, int to_count);
+
+  // Begin paths only at the vertices `costs[i].vertex` of the first layer, at
+  // total weight `costs[i].cost`, rather than at every vertex of the first
+  // layer at total weight zero. If a vertex is listed more than once, then
+  // its last cost counts. No costs means the default. The behavior is
+  // undefined if a layer has been pushed.
+  void set_initial_costs(std::span<const cost_type> costs);
+
+  // Like `set_initial_costs`, but the costs are total weights, which can be
+  // larger or more precise than edge weights, e.g. the total weights of the
+  // paths to the last layer of some earlier part of the graph.
+  void set_initial_totals(std::span<const total_cost_type> costs);
+
+  // End paths only at the vertices `costs[i].vertex` of the last layer, and
+  // add `costs[i].cost` to the total weight of a path that ends there, as
+  // reported by the head of the path. If a vertex is listed more than once,
+  // then its last cost counts. No costs means the default, which is to end
+  // paths at every vertex at no cost. This can be called at any time before
+  // asking for the paths.
+  void set_terminal_costs(std::span<const cost_type> costs);
+
+  // Return all of the paths of minimal total weight through the layers pushed
+  // so far, in order of their last vertex. There are none if no layer has
+  // been pushed, if a layer had no edges, if no path reaches a terminal vertex
+  // (see `set_terminal_costs`), or if every path that would have reached the
+  // last layer began at a vertex without an initial cost (see
+  // `set_initial_costs`) or was pruned by beam search (see
+  // `SolveOptions::beam_width`).
+  std::vector<PathType> result() const;
+
+  // Return the `k` paths of least total weight through the layers pushed so
+  // far, one per vertex of the last layer, in order of total weight and then
+  // of last vertex, or all of the paths if there are fewer than `k`. Unlike
+  // `result`, this includes paths that aren't optimal, e.g. `best(3)` might
+  // return the optimal path and the two runners up.
+  std::vector<PathType> best(std::size_t k) const;
+
+  // Return whether the paths returned by `result` are all of the optimal
+  // paths, as if there were no beam search (see `SolveOptions::beam_width`).
+  // That's so if no path through a pruned vertex could cost as little as
+  // them, judging by the least edge weight of each layer after the pruning.
+  // It's always so without beam search, and never so if beam search pruned
+  // every path. The behavior is undefined unless at least one layer has been
+  // pushed.
+  bool provably_optimal() const;
+
+  // Return the number of layers pushed so far.
+  int layers() const;
+
+  // Forget all of the layers pushed so far, and the initial and terminal
+  // costs, to begin another graph.
+  void reset();
+
+  // Write the state of the solver to `output`, so that a solver that
+  // `restore`s it carries on from the next layer just as this one would (see
+  // `checkpoint.h`). The options aren't part of the state.
+  void save(CheckpointWriter& output) const;
+
+  // Replace the state of the solver with one read from `input`, as written by
+  // `save` for paths of the same weight type. Return `false` and assign a
+  // diagnostic to `error` if it can't be read, in which case the solver is
+  // `reset`.
+  bool restore(CheckpointReader& input, std::string& error);
+};
+
+template <typename PathType = Path, typename EdgeRangeIterator>
+std::vector<PathType> cheapest_paths(
+    EdgeRangeIterator layer,
+    EdgeRangeIterator layers_end,
+    const SolveOptions& options = SolveOptions{}) {
+  // `*layer` can be unpacked as two forward iterators to `BasicEdge<Weight>`,
+  // where `Weight` is the weight type of `PathType` (e.g. `Edge` for `Path`).
+  // The idea is that a layer is represented as a sequence of edges from the
+  // previous layer to the the current layer, and `[layer, layers_end)` is a
+  // sequence of layers.
+  // The sequences of edges are covered by forward iterators, while `layer` is
+  // an input iterator (so layers can be generated lazily).
+  CheapestPathsSolver<PathType> solver{options};
+  for (; layer != layers_end; ++layer) {
+    const auto [edges_begin, edges_end] = *layer;
+    solver.push_layer(edges_begin, edges_end);
+  }
+  return solver.result();
+}
+
+// `best_paths` is like `cheapest_paths`, except that it returns the `k` best
+// paths, optimal or not (see `CheapestPathsSolver::best`).
+template <typename PathType = Path, typename EdgeRangeIterator>
+std::vector<PathType> best_paths(
+    EdgeRangeIterator layer,
+    EdgeRangeIterator layers_end,
+    std::size_t k,
+    const SolveOptions& options = SolveOptions{}) {
+  CheapestPathsSolver<PathType> solver{options};
+  for (; layer != layers_end; ++layer) {
+    const auto [edges_begin, edges_end] = *layer;
+    solver.push_layer(edges_begin, edges_end);
+  }
+  return solver.best(k);
+}
+
+// Implementation
+// ==============
+
+// class CheapestPathsSolver<PathType>
+// -----------------------------------
+template <typename PathType>
+CheapestPathsSolver<PathType>::CheapestPathsSolver(const SolveOptions& options)
+: options(options)
+, deferred_reclamation(options) {
+}
+
+template <typename PathType>
+template <typename EdgeIterator>
+void CheapestPathsSolver<PathType>::push_layer(
+    EdgeIterator edges_begin,
+    EdgeIterator edges_end) {
+  LAYER_METRIC(layer_start_ticks = metrics_ticks();)
+  ++layer_count;
+  debug << "Examining layer " << layer_count << '\n';
+  // Deduce which vertices are in a layer by examining the vertices named in
+  // the edges between the two layers.
+  int max_previous_vertex = -1;
+  int max_current_vertex = -1;
+  weight_type min_weight = std::numeric_limits<weight_type>::max();
+  std::size_t num_edges = 0;
+  for (auto iter = edges_begin; iter != edges_end; ++iter) {
+    const edge_type& edge = *iter;
+    max_previous_vertex = std::max(max_previous_vertex, edge.from);
+    max_current_vertex = std::max(max_current_vertex, edge.to);
+    min_weight = std::min(min_weight, edge.weight);
+    ++num_edges;
+  }
+  choose_vertex_ids(std::max(max_previous_vertex, max_current_vertex), num_edges);
+
+  if (sparse) {
+    current_index.clear();
+    sparse_edges.clear();
+    for (auto iter = edges_begin; iter != edges_end; ++iter) {
+      const edge_type& edge = *iter;
+      sparse_edges.push_back(edge_type{
+        .from = previous_index.insert(edge.from),
+        .to = current_index.insert(edge.to),
+        .weight = edge.weight
+      });
+    }
+    relax_layer(
+      sparse_edges.cbegin(),
+      sparse_edges.cend(),
+      num_edges,
+      previous_index.size(),
+      current_index.size());
+  } else {
+    relax_layer(
+      edges_begin,
+      edges_end,
+      num_edges,
+      std::size_t(max_previous_vertex + 1),
+      std::size_t(max_current_vertex + 1));
+  }
+
+  finish_layer(min_weight, num_edges);
+}
+
+template <typename PathType>
+template <typename EdgeIterator>
+void CheapestPathsSolver<PathType>::relax_layer(
+    EdgeIterator edges_begin,
+    EdgeIterator edges_end,
+    std::size_t num_edges,
+    std::size_t from_count,
+    std::size_t to_count) {
+  begin_layer(from_count, to_count);
+
+  bool relaxed = false;
+  if constexpr (std::random_access_iterator<EdgeIterator>) {
+    const DenseOrder order = options.dense_min_edges && num_edges >= options.dense_min_edges
+      ? dense_order(edges_begin, num_edges, from_count, to_count)
+      : DenseOrder::none;
+    if (order == DenseOrder::by_from &&
+        dense_weights(edges_begin, from_count, to_count, dense_scratch.weights)) {
+      debug << "    relaxing a dense layer of " << num_edges << " edges\n";
+      relax_dense_layer(dense_scratch.weights.data(), from_count, to_count, previous_costs.data());
+      relaxed = true;
+    } else if (order == DenseOrder::by_to) {
+      if constexpr (std::contiguous_iterator<EdgeIterator>) {
+        debug << "    relaxing a dense layer of " << num_edges << " edges\n";
+        relaxed = relax_dense_layer_by_to(std::to_address(edges_begin), from_count, to_count);
+        if (!relaxed) {
+          // It's not dense after all, so start over.
+          current_costs.assign(to_count, Total{});
+          current_predecessors.assign(to_count, -1);
+        }
+      }
+    }
+    if (!relaxed && options.threads > 1 && num_edges >= options.parallel_min_edges) {
+      debug << "    relaxing " << num_edges << " edges on " << options.threads << " threads\n";
+      relax_in_parallel(
+        edges_begin,
+        edges_end,
+        previous_costs,
+        current_costs,
+        current_predecessors,
+        options.threads,
+        parallel_scratch);
+      relaxed = true;
+    }
+  }
+
+  LAYER_METRIC(improved_edges_counted = !relaxed;)
+  if (!relaxed) {
+    // Update `current_costs` and `current_predecessors` based on the edges
+    // between the two layers.
+    LAYER_METRIC(std::size_t improved = 0;)
+    for (auto iter = edges_begin; iter != edges_end; ++iter) {
+      const auto [from, to, weight] = *iter;
+      const Total proposed_total = previous_costs[from] + weight;
+      if (current_predecessors[to] < 0 || current_costs[to] > proposed_total) {
+        debug << "    current vertex " << to << " now has minimum weight " << proposed_total << '\n';
+        current_costs[to] = proposed_total;
+        current_predecessors[to] = from;
+        LAYER_METRIC(++improved;)
+      }
+    }
+    LAYER_METRIC(improved_edges = improved;)
+  }
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::push_layer(std::span<const edge_type> edges) {
+  push_layer(edges.begin(), edges.end());
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::push_dense_layer(
+    std::span<const weight_type> weights,
+    int from_count,
+    int to_count) {
+  assert(from_count > 0 && to_count > 0);
+  assert(weights.size() == std::size_t(from_count) * to_count);
+  LAYER_METRIC(layer_start_ticks = metrics_ticks();)
+  LAYER_METRIC(improved_edges_counted = false;)
+  ++layer_count;
+  debug << "Examining dense layer " << layer_count << '\n';
+  choose_vertex_ids(std::max(from_count, to_count) - 1, weights.size());
+  const weight_type min_weight = beam() ? std::ranges::min(weights) : weight_type{};
+  if (!sparse) {
+    begin_layer(from_count, to_count);
+    relax_dense_layer(weights.data(), from_count, to_count, previous_costs.data());
+    finish_layer(min_weight, weights.size());
+    return;
+  }
+
+  // The `from` vertices are named 0 through `from_count - 1`, so gather
+  // their costs into `sparse_costs` in order of name. The `to` vertices'
+  // names are their indices.
+  sparse_froms.resize(from_count);
+  for (int from = 0; from != from_count; ++from) {
+    sparse_froms[from] = previous_index.insert(from);
+  }
+  current_index.clear();
+  for (int to = 0; to != to_count; ++to) {
+    current_index.insert(to);
+  }
+  begin_layer(previous_index.size(), to_count);
+  sparse_costs.resize(from_count);
+  for (int from = 0; from != from_count; ++from) {
+    sparse_costs[from] = previous_costs[sparse_froms[from]];
+  }
+  relax_dense_layer(weights.data(), from_count, to_count, sparse_costs.data());
+  for (int to = 0; to != to_count; ++to) {
+    current_predecessors[to] = sparse_froms[current_predecessors[to]];
+  }
+  finish_layer(min_weight, weights.size());
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::choose_vertex_ids(int max_vertex, std::size_t num_edges) {
+  if (sparse) {
+    return;
+  }
+  if (options.vertex_ids == VertexIds::sparse ||
+      (options.vertex_ids == VertexIds::automatic &&
+       max_vertex >= options.sparse_min_vertex &&
+       std::size_t(max_vertex) / 16 > num_edges)) {
+    switch_to_sparse();
+  }
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::switch_to_sparse() {
+  debug << "    switching to sparse vertex names\n";
+  sparse = true;
+  previous_index.clear();
+  current_index.clear();
+  // Vertices without paths have nothing to remember, so leave them out,
+  // unless beam search pruned them, which has to be remembered.
+  std::size_t count = 0;
+  for (std::size_t vertex = 0; vertex != previous_layer.size(); ++vertex) {
+    if (previous_layer[vertex].empty() &&
+        previous_costs[vertex] != pruned_total_weight<Total>()) {
+      continue;
+    }
+    previous_index.insert(int(vertex));
+    if (count != vertex) {
+      previous_layer[count] = std::move(previous_layer[vertex]);
+      previous_costs[count] = previous_costs[vertex];
+    }
+    ++count;
+  }
+  previous_layer.resize(count);
+  previous_costs.resize(count);
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::begin_layer(
+    std::size_t from_count,
+    std::size_t to_count) {
+  if (layer_count == 1 && !initial_costs.empty()) {
+    // The vertices of the first layer that have no initial cost are as if
+    // pruned. A vertex that no edge leaves doesn't matter.
+    previous_costs.assign(from_count, pruned_total_weight<Total>());
+    for (const total_cost_type& initial : initial_costs) {
+      const int from = sparse ? previous_index.find(initial.vertex) : initial.vertex;
+      if (from >= 0 && std::size_t(from) < from_count) {
+        previous_costs[from] = initial.cost;
+      }
+    }
+  }
+  previous_layer.resize(from_count);
+  previous_costs.resize(from_count, Total{});
+  current_layer.resize(to_count);
+  current_costs.assign(to_count, Total{});
+  current_predecessors.assign(to_count, -1);
+  debug << "    previous layer has " << previous_layer.size() << " vertices\n";
+  debug << "    current layer has " << current_layer.size() << " vertices\n";
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::relax_dense_layer(
+    const weight_type *weights,
+    std::size_t from_count,
+    std::size_t to_count,
+    const Total *from_costs) {
+  dense_scratch.predecessors.resize(to_count);
+  const auto relax = [&](std::size_t to_begin, std::size_t to_end) {
+    relax_dense(
+      weights,
+      from_count,
+      to_count,
+      from_costs,
+      current_costs.data(),
+      current_predecessors.data(),
+      dense_scratch.predecessors.data(),
+      to_begin,
+      to_end);
+  };
+  relax_by_to(from_count, to_count, relax);
+}
+
+template <typename PathType>
+bool CheapestPathsSolver<PathType>::relax_dense_layer_by_to(
+    const edge_type *edges,
+    std::size_t from_count,
+    std::size_t to_count) {
+  std::atomic<bool> dense = true;
+  relax_by_to(from_count, to_count, [&](std::size_t to_begin, std::size_t to_end) {
+    if (!relax_dense_by_to(
+        edges,
+        from_count,
+        previous_costs.data(),
+        current_costs.data(),
+        current_predecessors.data(),
+        to_begin,
+        to_end)) {
+      dense = false;
+    }
+  });
+  return dense;
+}
+
+template <typename PathType>
+template <typename Relax>
+void CheapestPathsSolver<PathType>::relax_by_to(
+    std::size_t from_count,
+    std::size_t to_count,
+    const Relax& relax) {
+  const int threads = options.threads;
+  if (threads > 1 && from_count * to_count >= options.parallel_min_edges) {
+    // Each thread takes a contiguous range of `to` vertices.
+    run_on_threads(threads, [&](int thread) {
+      relax(to_count * thread / threads, to_count * (thread + 1) / threads);
+    });
+  } else {
+    relax(0, to_count);
+  }
+}
+
+template <typename PathType>
+bool CheapestPathsSolver<PathType>::beam() const {
+  return options.beam_width || options.beam_margin < std::numeric_limits<double>::infinity();
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::prune_layer(weight_type min_weight, std::size_t num_edges) {
+  constexpr Total pruned = pruned_total_weight<Total>();
+  // Paths through vertices pruned before are one edge longer now, or gone,
+  // if the layer has no edges.
+  if (num_edges == 0) {
+    beam_pruned = false;
+  } else if (beam_pruned) {
+    beam_bound = beam_bound + min_weight;
+  }
+  const auto prune = [&](int to) {
+    if (!beam_pruned || current_costs[to] < beam_bound) {
+      beam_bound = current_costs[to];
+    }
+    beam_pruned = true;
+    current_costs[to] = pruned;
+    current_predecessors[to] = -1;
+  };
+
+  // The vertices reached only from pruned vertices are pruned too, but they
+  // don't affect `beam_bound`, since their predecessors already did. The
+  // rest are candidates.
+  std::vector<int>& candidates = beam_candidates;
+  candidates.clear();
+  for (std::size_t to = 0; to != current_predecessors.size(); ++to) {
+    const int from = current_predecessors[to];
+    if (from < 0) {
+      continue;
+    }
+    if (previous_costs[from] == pruned) {
+      current_costs[to] = pruned;
+      current_predecessors[to] = -1;
+      continue;
+    }
+    candidates.push_back(int(to));
+  }
+  if (candidates.empty()) {
+    return;
+  }
+
+  if (options.beam_margin < std::numeric_limits<double>::infinity()) {
+    Total least = current_costs[candidates.front()];
+    for (const int to : candidates) {
+      least = std::min(least, current_costs[to]);
+    }
+    std::erase_if(candidates, [&](int to) {
+      if (double(current_costs[to] - least) <= options.beam_margin) {
+        return false;
+      }
+      prune(to);
+      return true;
+    });
+  }
+
+  if (options.beam_width && candidates.size() > options.beam_width) {
+    // Break ties by name, as `best` does.
+    const int *const names = sparse ? current_index.names().data() : nullptr;
+    const auto by_total_weight = [&](int left, int right) {
+      return current_costs[left] < current_costs[right] ||
+        (current_costs[left] == current_costs[right] &&
+         (names ? names[left] < names[right] : left < right));
+    };
+    std::nth_element(
+      candidates.begin(),
+      candidates.begin() + options.beam_width,
+      candidates.end(),
+      by_total_weight);
+    for (auto to = candidates.begin() + options.beam_width; to != candidates.end(); ++to) {
+      prune(*to);
+    }
+    candidates.resize(options.beam_width);
+  }
+  debug << "    beam search kept " << candidates.size() << " vertices\n";
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::finish_layer(weight_type min_weight, std::size_t num_edges) {
+  if (beam() || !initial_costs.empty()) {
+    prune_layer(min_weight, num_edges);
+  }
+
+  [[maybe_unused]] const std::size_t allocated = extend_paths(
+    previous_layer,
+    current_layer,
+    previous_costs,
+    current_costs,
+    current_predecessors,
+    sparse ? previous_index.names().data() : nullptr,
+    sparse ? current_index.names().data() : nullptr);
+
+  using std::swap;
+  swap(previous_layer, current_layer);
+  swap(previous_costs, current_costs);
+  if (sparse) {
+    swap(previous_index, current_index);
+  }
+  // Release the paths of the layer before, now that nothing will be
+  // prepended to them.
+  current_layer.clear();
+
+  if (options.on_commit && layer_count % options.commit_interval == 0) {
+    commit_merged_prefix(previous_layer, layer_count, options, commit_scratch);
+  }
+
+  if (options.reclaim_budget) {
+    const std::size_t freed =
+      PathType::reclaim(std::max(options.reclaim_budget, previous_layer.size()));
+    debug << "    reclaimed " << freed << " path nodes\n";
+  }
+
+  LISPYLIST_STAT(
+    if (options.stats && layer_count % options.stats_interval == 0) {
+      stats_reporter.report(*options.stats, layer_count, options.stats_interval);
+    })
+
+  LAYER_METRIC(
+    if (LayerMetrics *const metrics = options.metrics) {
+      metrics->relax.record(metrics_ticks() - layer_start_ticks);
+      metrics->edges.record(num_edges);
+      if (improved_edges_counted) {
+        metrics->improved_edges.record(improved_edges);
+      }
+      metrics->allocated_nodes.record(allocated);
+    })
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::set_initial_costs(std::span<const cost_type> costs) {
+  assert(layer_count == 0);
+  initial_costs.clear();
+  for (const cost_type& cost : costs) {
+    initial_costs.push_back(total_cost_type{.vertex = cost.vertex, .cost = cost.cost});
+  }
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::set_initial_totals(std::span<const total_cost_type> costs) {
+  assert(layer_count == 0);
+  initial_costs.assign(costs.begin(), costs.end());
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::set_terminal_costs(std::span<const cost_type> costs) {
+  terminal_costs.assign(costs.begin(), costs.end());
+  std::stable_sort(terminal_costs.begin(), terminal_costs.end(), [](const cost_type& left, const cost_type& right) {
+    return left.vertex < right.vertex;
+  });
+  // Keep the last cost of each vertex.
+  auto kept = terminal_costs.begin();
+  for (auto terminal = terminal_costs.begin(); terminal != terminal_costs.end(); ++terminal) {
+    if (std::next(terminal) == terminal_costs.end() || std::next(terminal)->vertex != terminal->vertex) {
+      *kept++ = *terminal;
+    }
+  }
+  terminal_costs.erase(kept, terminal_costs.end());
+}
+
+template <typename PathType>
+template <typename Visit>
+void CheapestPathsSolver<PathType>::for_each_end(const Visit& visit) const {
+  if (terminal_costs.empty()) {
+    for (std::size_t vertex = 0; vertex != previous_layer.size(); ++vertex) {
+      if (!previous_layer[vertex].empty()) {
+        visit(int(vertex), previous_costs[vertex]);
+      }
+    }
+    return;
+  }
+  for (const cost_type& terminal : terminal_costs) {
+    const int vertex = sparse ? previous_index.find(terminal.vertex) : terminal.vertex;
+    if (vertex >= 0 && std::size_t(vertex) < previous_layer.size() &&
+        !previous_layer[vertex].empty()) {
+      visit(vertex, previous_costs[vertex] + terminal.cost);
+    }
+  }
+}
+
+template <typename PathType>
+PathType CheapestPathsSolver<PathType>::end_path(int vertex, Total total_weight) const {
+  const PathType& path = previous_layer[vertex];
+  if (total_weight == previous_costs[vertex]) {
+    return path;
+  }
+  // Replace the head, so that it tells the total weight including the
+  // terminal cost. The rest of the path is shared.
+  using State = typename PathType::value_type;
+  return path.tail().prepend(State{
+    .least_total_weight_to_here = total_weight,
+    .vertex = path.head().vertex
+  });
+}
+
+template <typename PathType>
+std::vector<PathType> CheapestPathsSolver<PathType>::result() const {
+  // `previous_layer` contains the paths to the vertices in the last layer,
+  // and `previous_costs` their total weights. Collect the vertices of least
+  // total weight in one pass, starting over whenever a lesser total turns up.
+  // That happens only a handful of times, unless the totals happen to
+  // decrease with the vertex.
+  std::vector<int> vertices;
+  Total least_total_weight{};
+  for_each_end([&](int vertex, Total total_weight) {
+    if (vertices.empty() || total_weight < least_total_weight) {
+      vertices.clear();
+      least_total_weight = total_weight;
+    } else if (total_weight != least_total_weight) {
+      return;
+    }
+    vertices.push_back(vertex);
+  });
+  if (sparse && terminal_costs.empty()) {
+    // Sparse indices are in order of appearance, not of name.
+    const std::vector<int>& names = previous_index.names();
+    std::sort(vertices.begin(), vertices.end(), [&](int left, int right) {
+      return names[left] < names[right];
+    });
+  }
+
+  std::vector<PathType> paths;
+  paths.reserve(vertices.size());
+  for (const int vertex : vertices) {
+    paths.push_back(end_path(vertex, least_total_weight));
+  }
+  return paths;
+}
+
+template <typename PathType>
+std::vector<PathType> CheapestPathsSolver<PathType>::best(std::size_t k) const {
+  // Select among the vertices rather than the paths, so that the paths don't
+  // have to be moved around, and then copy out the winners.
+  struct End {
+    int vertex;
+    Total total_weight;
+  };
+  std::vector<End> ends;
+  for_each_end([&](int vertex, Total total_weight) {
+    ends.push_back(End{.vertex = vertex, .total_weight = total_weight});
+  });
+  const int *const names = sparse ? previous_index.names().data() : nullptr;
+  const auto by_total_weight = [&](const End& left, const End& right) {
+    return left.total_weight < right.total_weight ||
+      (left.total_weight == right.total_weight &&
+       (names ? names[left.vertex] < names[right.vertex] : left.vertex < right.vertex));
+  };
+  if (k < ends.size()) {
+    std::nth_element(ends.begin(), ends.begin() + k, ends.end(), by_total_weight);
+    ends.resize(k);
+  }
+  std::sort(ends.begin(), ends.end(), by_total_weight);
+
+  std::vector<PathType> paths;
+  paths.reserve(ends.size());
+  for (const End& end : ends) {
+    paths.push_back(end_path(end.vertex, end.total_weight));
+  }
+  return paths;
+}
+
+template <typename PathType>
+bool CheapestPathsSolver<PathType>::provably_optimal() const {
+  if (!beam_pruned) {
+    return true;
+  }
+  bool found = false;
+  Total least_total_weight{};
+  for_each_end([&](int, Total total_weight) {
+    if (!found || total_weight < least_total_weight) {
+      least_total_weight = total_weight;
+      found = true;
+    }
+  });
+  // A path through a pruned vertex costs at least `beam_bound`, plus the
+  // least terminal cost, if there are terminal costs. If that's more than
+  // the least total weight found, then pruning lost nothing.
+  Total bound = beam_bound;
+  if (!terminal_costs.empty()) {
+    bound = bound + std::ranges::min(terminal_costs, {}, &cost_type::cost).cost;
+  }
+  return found && bound > least_total_weight;
+}
+
+template <typename PathType>
+int CheapestPathsSolver<PathType>::layers() const {
+  return layer_count;
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::reset() {
+  previous_layer.clear();
+  current_layer.clear();
+  previous_costs.clear();
+  sparse = false;
+  previous_index.clear();
+  current_index.clear();
+  beam_pruned = false;
+  initial_costs.clear();
+  terminal_costs.clear();
+  layer_count = 0;
+  LISPYLIST_STAT(stats_reporter = StatsReporter{};)
+}
+
+template <typename PathType>
+void CheapestPathsSolver<PathType>::save(CheckpointWriter& output) const {
+  // First, the type of the weights, so that `restore` can tell whether it
+  // has the right one.
+  output.put(std::uint8_t(sizeof(weight_type)));
+  output.put(std::uint8_t(std::is_integral_v<weight_type>));
+  output.put_varint(layer_count);
+  output.put(std::uint8_t(sparse));
+  output.put(std::uint8_t(beam_pruned));
+  output.put(beam_bound);
+  const auto put_costs = [&](const auto& costs) {
+    output.put_varint(costs.size());
+    for (const auto& cost : costs) {
+      output.put_varint(cost.vertex);
+      output.put(cost.cost);
+    }
+  };
+  put_costs(initial_costs);
+  put_costs(terminal_costs);
+
+  // Then the vertices of the last layer: their names, if they're sparse,
+  // and their total weights.
+  output.put_varint(previous_layer.size());
+  if (sparse) {
+    for (const int name : previous_index.names()) {
+      output.put_varint(name);
+    }
+  }
+  for (const Total cost : previous_costs) {
+    output.put(cost);
+  }
+
+  // Then their paths. The nodes are numbered from one, in the order written.
+  // For each vertex, the nodes of its path that haven't been written yet are
+  // written, tail first: how many of them there are, and then for each, its
+  // vertex, its total weight, and how many nodes back its next node was
+  // written, or zero if it has none. If there are no such nodes, then the
+  // number of the path's head is written instead, or zero if the path is
+  // empty.
+  using State = typename PathType::value_type;
+  std::unordered_map<std::uintptr_t, std::uint64_t> numbers; // by node id
+  std::vector<State> unwritten;
+  std::vector<std::uintptr_t> unwritten_ids;
+  std::uint64_t written = 0;
+  for (const PathType& path : previous_layer) {
+    unwritten.clear();
+    unwritten_ids.clear();
+    std::uint64_t next = 0; // the number of the first node already written
+    for (auto node = path.begin(); node != path.end(); ++node) {
+      if (const auto found = numbers.find(node.id()); found != numbers.end()) {
+        next = found->second;
+        break;
+      }
+      unwritten.push_back(*node);
+      unwritten_ids.push_back(node.id());
+    }
+    output.put_varint(unwritten.size());
+    if (unwritten.empty()) {
+      output.put_varint(next);
+      continue;
+    }
+    for (std::size_t i = unwritten.size(); i--;) {
+      output.put_varint(unwritten[i].vertex);
+      output.put(unwritten[i].least_total_weight_to_here);
+      output.put_varint(next ? written + 1 - next : 0);
+      numbers.emplace(unwritten_ids[i], ++written);
+      next = written;
+    }
+  }
+}
+
+template <typename PathType>
+bool CheapestPathsSolver<PathType>::restore(CheckpointReader& input, std::string& error) {
+  reset();
+  std::uint64_t number;
+  const auto get_vertex = [&](int& vertex) {
+    if (!input.get_varint(number) || number > std::uint64_t(std::numeric_limits<int>::max())) {
+      return false;
+    }
+    vertex = int(number);
+    return true;
+  };
+
+  const char *problem = "the checkpoint is truncated or corrupt";
+  const bool restored = [&] {
+    std::uint8_t weight_size;
+    std::uint8_t weight_integral;
+    if (!input.get(weight_size) || !input.get(weight_integral)) {
+      return false;
+    }
+    if (weight_size != sizeof(weight_type) || weight_integral != std::is_integral_v<weight_type>) {
+      problem = "the checkpoint is of a graph with a different type of weights";
+      return false;
+    }
+    std::uint8_t sparse_flag;
+    std::uint8_t beam_pruned_flag;
+    if (!get_vertex(layer_count) || !input.get(sparse_flag) ||
+        !input.get(beam_pruned_flag) || !input.get(beam_bound)) {
+      return false;
+    }
+    sparse = sparse_flag;
+    beam_pruned = beam_pruned_flag;
+    const auto get_costs = [&](auto& costs) {
+      std::uint64_t count;
+      if (!input.get_varint(count)) {
+        return false;
+      }
+      for (; count; --count) {
+        auto& cost = costs.emplace_back();
+        if (!get_vertex(cost.vertex) || !input.get(cost.cost)) {
+          return false;
+        }
+      }
+      return true;
+    };
+    if (!get_costs(initial_costs) || !get_costs(terminal_costs)) {
+      return false;
+    }
+
+    std::uint64_t count;
+    if (!input.get_varint(count)) {
+      return false;
+    }
+    if (sparse) {
+      for (std::uint64_t index = 0; index != count; ++index) {
+        int name;
+        if (!get_vertex(name) || previous_index.insert(name) != int(index)) {
+          return false; // truncated, or the same name twice
+        }
+      }
+    }
+    for (std::uint64_t vertex = 0; vertex != count; ++vertex) {
+      if (!input.get(previous_costs.emplace_back())) {
+        return false;
+      }
+    }
+
+    using State = typename PathType::value_type;
+    const PathType nil;
+    std::vector<PathType> nodes; // by number, less one
+    for (std::uint64_t vertex = 0; vertex != count; ++vertex) {
+      std::uint64_t unwritten;
+      if (!input.get_varint(unwritten)) {
+        return false;
+      }
+      if (unwritten == 0) {
+        if (!input.get_varint(number) || number > nodes.size()) {
+          return false;
+        }
+        previous_layer.push_back(number ? nodes[number - 1] : nil);
+        continue;
+      }
+      for (; unwritten; --unwritten) {
+        State state;
+        std::uint64_t back;
+        if (!get_vertex(state.vertex) || !input.get(state.least_total_weight_to_here) ||
+            !input.get_varint(back) || back > nodes.size()) {
+          return false;
+        }
+        PathType node = (back ? nodes[nodes.size() - back] : nil).prepend(state);
+        nodes.push_back(std::move(node));
+      }
+      previous_layer.push_back(nodes.back());
+    }
+    return input.ok();
+  }();
+
+  if (!restored) {
+    error = problem;
+    reset();
+  }
+  return restored;
+}
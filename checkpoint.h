@@ -0,0 +1,464 @@
+// A checkpoint is the state of a `CheapestPathsSolver` partway through a
+// graph, saved to a file, so that a solve that's interrupted can resume from
+// the checkpoint, rather than from the first layer. The state is the number of
+// layers pushed, the total weights of the vertices of the last layer pushed,
+// the paths to them, and whatever else the solver carries from one layer to
+// the next (see `CheapestPathsSolver::save`). The paths share their prefixes
+// (see `paths.h`), and so do they in the file: each path node is written once,
+// however many of the paths contain it.
+//
+// The layout of a checkpoint file is:
+//
+//     CheckpointHeader header;
+//     (the state of the solver)
+//
+// where `header.input` is the kind of input that the layers were read from,
+// and `header.input_offset` is, for text, the offset in it of the line after
+// the last layer pushed (see `LineReader::offset`). So that a checkpoint isn't
+// resumed against some other input, which would silently give the wrong
+// answer, the header also has the number of layers pushed, and a fingerprint
+// of the last of them (see `layer_fingerprint`), which `read_checkpoint` lets
+// its caller check against the input. The header is in
+// host byte order, as are the fixed size numbers of the solver's state, and
+// `header.byte_order` is used to reject files written on a machine of
+// different endianness. The rest of the numbers of the state are unsigned
+// LEB128 "varints", which take one byte apiece for small numbers.
+//
+// `Checkpointer` writes checkpoints without holding up the solver for long: it
+// forks, and the child process writes the checkpoint from its copy-on-write
+// snapshot of the parent's memory while the parent carries on. A checkpoint is
+// written to a temporary file that's then renamed over the previous
+// checkpoint, so the checkpoint file is always a complete checkpoint.
+
+#pragma once
+
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the kind of input that a checkpoint's layers were read from
+enum class CheckpointInput : std::uint32_t {
+  text = 1,
+  layer_file = 2
+};
+
+struct CheckpointHeader {
+  char magic[8]; // `checkpoint_magic`
+  std::uint32_t byte_order; // `checkpoint_byte_order`, as written
+  std::uint32_t version; // `checkpoint_version`
+  CheckpointInput input;
+  std::uint32_t reserved; // zero
+  std::uint64_t input_offset; // zero for a layer file
+  std::uint64_t layers; // the number of layers pushed
+  std::uint64_t last_layer_fingerprint; // or zero if `layers` is zero
+};
+
+constexpr char checkpoint_magic[8] = {'S', 'P', 'C', 'H', 'E', 'C', 'K', 'P'};
+constexpr std::uint32_t checkpoint_byte_order = 0x01020304;
+constexpr std::uint32_t checkpoint_version = 3;
+
+static_assert(sizeof(CheckpointHeader) == 48);
+
+// Return a hash of the edges `[edges_begin, edges_end)` of a layer, which are
+// some `BasicEdge`s. A layer hashes the same whichever weight type it was
+// read with, as long as the weights are the same numbers.
+template <typename EdgeIterator>
+std::uint64_t layer_fingerprint(EdgeIterator edges_begin, EdgeIterator edges_end) {
+  // FNV-1a, a word at a time rather than a byte at a time
+  std::uint64_t hash = 0xcbf29ce484222325;
+  const auto mix = [&](std::uint64_t word) {
+    hash = (hash ^ word) * 0x100000001b3;
+  };
+  for (; edges_begin != edges_end; ++edges_begin) {
+    const auto& edge = *edges_begin;
+    mix(std::uint64_t(std::uint32_t(edge.from)) | std::uint64_t(std::uint32_t(edge.to)) << 32);
+    mix(std::bit_cast<std::uint64_t>(double(edge.weight)));
+  }
+  return hash;
+}
+
+// `CheckpointWriter` writes the numbers of a checkpoint to a file descriptor,
+// through a buffer.
+class CheckpointWriter {
+  int fd;
+  std::vector<unsigned char> buffer;
+  std::size_t used = 0;
+  bool failed = false;
+
+  void reserve(std::size_t size);
+
+ public:
+  explicit CheckpointWriter(int fd);
+
+  // Append the bytes of `value`.
+  template <typename Value>
+  void put(const Value& value);
+
+  // Append `value` as a varint.
+  void put_varint(std::uint64_t value);
+
+  // Write whatever is still buffered. Return whether all output succeeded.
+  bool finish();
+};
+
+// `CheckpointReader` reads what a `CheckpointWriter` wrote, from a file
+// descriptor, through a buffer. Once a read fails, e.g. because the file is
+// truncated, every later read fails too.
+class CheckpointReader {
+  int fd;
+  std::vector<unsigned char> buffer;
+  std::size_t begin = 0;
+  std::size_t end = 0;
+  bool failed = false;
+
+  // Return whether at least `size` bytes are buffered, reading more if need
+  // be, and failing if there aren't that many left in the file.
+  bool fill(std::size_t size);
+
+ public:
+  explicit CheckpointReader(int fd);
+
+  // Read the bytes of `value`. Return `false` if there aren't enough left.
+  template <typename Value>
+  bool get(Value& value);
+
+  // Read a varint into `value`. Return `false` if there isn't one.
+  bool get_varint(std::uint64_t& value);
+
+  // Return whether every read so far succeeded.
+  bool ok() const;
+};
+
+// Write to `fd` a checkpoint of `solver`, some `CheapestPathsSolver`, noting
+// that its layers were read from an `input` that has been consumed up to
+// `input_offset`, and that the last of them has the `layer_fingerprint`
+// `last_layer_fingerprint`. Return whether all output succeeded.
+template <typename Solver>
+bool write_checkpoint(
+    int fd,
+    const Solver& solver,
+    CheckpointInput input,
+    std::uint64_t input_offset,
+    std::uint64_t last_layer_fingerprint);
+
+// Restore `solver`, some `CheapestPathsSolver`, from the checkpoint file at
+// `path`, and assign the input offset of the checkpoint to `input_offset`.
+// The checkpoint must have been taken from the same kind of `input`. Before
+// restoring anything, call `check_input(header, error)` with the checkpoint's
+// `CheckpointHeader`, which must return whether the input being resumed is
+// the one that the checkpoint was taken from, e.g. by comparing its layer
+// number `header.layers` with `header.last_layer_fingerprint`, or else
+// assign a diagnostic to `error` and return `false`. Return `false` and
+// assign a diagnostic to `error` if the file can't be read, isn't a valid
+// checkpoint for `solver`, or doesn't match the input, in which case `solver`
+// is reset.
+template <typename Solver, typename CheckInput>
+bool read_checkpoint(
+    const std::string& path,
+    Solver& solver,
+    CheckpointInput input,
+    const CheckInput& check_input,
+    std::uint64_t& input_offset,
+    std::string& error);
+
+class Checkpointer {
+  std::string path;
+  std::ostream *errors;
+  pid_t child = -1; // the process writing a checkpoint, if any
+
+  // Reap `child`, waiting for it if `wait`, and report to `errors` if it
+  // failed. Return `false` if `child` is still running.
+  bool reap(bool wait);
+
+ public:
+  // Write checkpoints to the file at `path`. If `errors` is not null, then
+  // report to it each checkpoint that couldn't be written.
+  explicit Checkpointer(std::string path, std::ostream *errors = nullptr);
+
+  Checkpointer(const Checkpointer&) = delete;
+  Checkpointer& operator=(const Checkpointer&) = delete;
+
+  // Wait for the checkpoint being written, if any.
+  ~Checkpointer();
+
+  // Fork a child process that invokes `write(fd)`, which returns whether it
+  // succeeded, to write a checkpoint to the file descriptor `fd`, and return
+  // `true`. Return `false` without forking if the previous checkpoint is still
+  // being written, since the checkpoint would be out of date before it was
+  // done, or if the fork fails. `write` must not use other threads, since the
+  // child has only the calling thread.
+  template <typename Write>
+  bool begin(const Write& write);
+};
+
+// Implementation
+// ==============
+
+// class CheckpointWriter
+// ----------------------
+inline CheckpointWriter::CheckpointWriter(int fd)
+: fd(fd)
+, buffer(1 << 20) {
+}
+
+inline void CheckpointWriter::reserve(std::size_t size) {
+  if (buffer.size() - used < size) {
+    finish();
+  }
+}
+
+template <typename Value>
+void CheckpointWriter::put(const Value& value) {
+  static_assert(std::is_trivially_copyable_v<Value>);
+  reserve(sizeof value);
+  std::memcpy(buffer.data() + used, &value, sizeof value);
+  used += sizeof value;
+}
+
+inline void CheckpointWriter::put_varint(std::uint64_t value) {
+  reserve(10);
+  unsigned char *const bytes = buffer.data() + used;
+  std::size_t size = 0;
+  for (; value >= 0x80; value >>= 7) {
+    bytes[size++] = (value & 0x7f) | 0x80;
+  }
+  bytes[size++] = value;
+  used += size;
+}
+
+inline bool CheckpointWriter::finish() {
+  for (std::size_t written = 0; written != used && !failed;) {
+    const ssize_t count = ::write(fd, buffer.data() + written, used - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      failed = true;
+    } else {
+      written += count;
+    }
+  }
+  used = 0;
+  return !failed;
+}
+
+// class CheckpointReader
+// ----------------------
+inline CheckpointReader::CheckpointReader(int fd)
+: fd(fd)
+, buffer(1 << 20) {
+}
+
+inline bool CheckpointReader::fill(std::size_t size) {
+  if (end - begin >= size) {
+    return true;
+  }
+  std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+  end -= begin;
+  begin = 0;
+  while (!failed && end < size) {
+    const ssize_t count = ::read(fd, buffer.data() + end, buffer.size() - end);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      failed = true;
+    } else {
+      end += count;
+    }
+  }
+  return !failed;
+}
+
+template <typename Value>
+bool CheckpointReader::get(Value& value) {
+  static_assert(std::is_trivially_copyable_v<Value>);
+  if (!fill(sizeof value)) {
+    return false;
+  }
+  std::memcpy(&value, buffer.data() + begin, sizeof value);
+  begin += sizeof value;
+  return true;
+}
+
+inline bool CheckpointReader::get_varint(std::uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char byte;
+    if (!get(byte)) {
+      return false;
+    }
+    value |= std::uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  failed = true; // more than 64 bits
+  return false;
+}
+
+inline bool CheckpointReader::ok() const {
+  return !failed;
+}
+
+// Checkpoint files
+// ----------------
+template <typename Solver>
+bool write_checkpoint(
+    int fd,
+    const Solver& solver,
+    CheckpointInput input,
+    std::uint64_t input_offset,
+    std::uint64_t last_layer_fingerprint) {
+  CheckpointHeader header{};
+  std::memcpy(header.magic, checkpoint_magic, sizeof header.magic);
+  header.byte_order = checkpoint_byte_order;
+  header.version = checkpoint_version;
+  header.input = input;
+  header.input_offset = input_offset;
+  header.layers = std::uint64_t(solver.layers());
+  header.last_layer_fingerprint = solver.layers() ? last_layer_fingerprint : 0;
+  CheckpointWriter output{fd};
+  output.put(header);
+  solver.save(output);
+  return output.finish();
+}
+
+template <typename Solver, typename CheckInput>
+bool read_checkpoint(
+    const std::string& path,
+    Solver& solver,
+    CheckpointInput input,
+    const CheckInput& check_input,
+    std::uint64_t& input_offset,
+    std::string& error) {
+  solver.reset();
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = std::string{"unable to open the checkpoint file: "} + std::strerror(errno);
+    return false;
+  }
+  const bool restored = [&] {
+    CheckpointReader reader{fd};
+    CheckpointHeader header;
+    if (!reader.get(header) || std::memcmp(header.magic, checkpoint_magic, sizeof header.magic) != 0) {
+      error = "not a checkpoint file";
+      return false;
+    }
+    if (header.byte_order != checkpoint_byte_order) {
+      error = "checkpoint was written with a different byte order";
+      return false;
+    }
+    if (header.version != checkpoint_version) {
+      error = "unsupported checkpoint version " + std::to_string(header.version);
+      return false;
+    }
+    if (header.input != input) {
+      error = header.input == CheckpointInput::layer_file
+        ? "checkpoint was taken from a layer file, not from text"
+        : "checkpoint was taken from text, not from a layer file";
+      return false;
+    }
+    if (!check_input(header, error)) {
+      return false;
+    }
+    input_offset = header.input_offset;
+    if (!solver.restore(reader, error)) {
+      return false;
+    }
+    if (std::uint64_t(solver.layers()) != header.layers) {
+      error = "checkpoint header says " + std::to_string(header.layers) +
+        " layers, but its state has " + std::to_string(solver.layers());
+      solver.reset();
+      return false;
+    }
+    return true;
+  }();
+  ::close(fd);
+  return restored;
+}
+
+// class Checkpointer
+// ------------------
+inline Checkpointer::Checkpointer(std::string path, std::ostream *errors)
+: path(std::move(path))
+, errors(errors) {
+}
+
+inline Checkpointer::~Checkpointer() {
+  reap(true);
+}
+
+inline bool Checkpointer::reap(bool wait) {
+  if (child < 0) {
+    return true;
+  }
+  int status;
+  pid_t reaped;
+  do {
+    reaped = ::waitpid(child, &status, wait ? 0 : WNOHANG);
+  } while (reaped < 0 && errno == EINTR);
+  if (reaped == 0) {
+    return false;
+  }
+  child = -1;
+  if (errors && reaped > 0) {
+    // The child exits with the `errno` of what failed (see `begin`).
+    if (WIFSIGNALED(status)) {
+      *errors << "Unable to write the checkpoint file " << path << ": killed by signal " << WTERMSIG(status) << '\n';
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+      *errors << "Unable to write the checkpoint file " << path << ": " << std::strerror(WEXITSTATUS(status)) << '\n';
+    }
+  }
+  return true;
+}
+
+template <typename Write>
+bool Checkpointer::begin(const Write& write) {
+  if (!reap(false)) {
+    return false;
+  }
+  const pid_t pid = ::fork();
+  if (pid < 0) {
+    return false;
+  }
+  if (pid > 0) {
+    child = pid;
+    return true;
+  }
+
+  // This is the child. It must not return, lest it carry on solving, and it
+  // leaves with `_exit`, so that it doesn't flush the parent's buffered
+  // output a second time.
+  // Its exit status is the `errno` of whatever failed.
+  const std::string temporary = path + ".tmp";
+  int error = 0;
+  const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    error = errno;
+  } else {
+    errno = 0;
+    if (!write(fd) || ::fsync(fd) != 0) {
+      error = errno ? errno : EIO;
+    }
+    if (::close(fd) != 0 && !error) {
+      error = errno;
+    }
+  }
+  if (!error && ::rename(temporary.c_str(), path.c_str()) != 0) {
+    error = errno;
+  }
+  ::_exit(error < 256 ? error : EIO);
+}
@@ -0,0 +1,343 @@
+// `chunked_cheapest_paths` finds the same paths as `cheapest_paths`, for a
+// graph whose layers are all in memory, using many threads even if the layers
+// are narrow. The solver relaxes one layer after another, so a graph of ten
+// million layers four vertices wide keeps one thread busy for a long time,
+// however many there are. Instead, the layers are split into chunks of
+// consecutive layers, and then:
+//
+// 1. Each chunk is reduced, on a thread of its own, to a min-plus "transfer
+//    matrix" (see `ChunkTransfer`): the least total weight of a path through
+//    the chunk from each vertex of its first layer to each vertex of its last
+//    layer, and of a path that begins within the chunk. The first chunk is
+//    relaxed from the initial costs instead, as the solver would.
+// 2. The total weights of the paths to the vertices at each boundary between
+//    chunks are found in order, by combining the total weights at the
+//    previous boundary with the matrix of the chunk in between. This takes
+//    time proportional to the widths of the chunk's ends, not to its length.
+// 3. Each chunk is solved on a thread of its own by a `CheapestPathsSolver`
+//    whose paths begin at the vertices of the chunk's first layer, at their
+//    total weights (see `set_initial_totals`). The solvers' paths are
+//    `SharedPath`s, so that they can be handed back to the calling thread.
+// 4. The paths found in the last chunk are traced back through the paths of
+//    the chunks before it, and copied into `PathType`s.
+//
+// Reducing a chunk costs as much as relaxing it once for each vertex of its
+// first layer, plus once more, so the whole takes a few times the work of the
+// serial solve, divided between the threads. That's a good deal for a narrow
+// graph that's much longer than there are threads, and a bad one for a wide
+// graph, whose layers are better relaxed in parallel by the solver itself
+// (see `SolveOptions::threads`).
+//
+// With integer weights, the paths are exactly those of `cheapest_paths`. With
+// floating point weights, the total weights at the boundaries are summed in a
+// different order, so they can differ in their last bits from the serial
+// solve's, and then a tie might be broken differently.
+
+#pragma once
+
+#include "cheapestpaths.h"
+#include "layer.h"
+#include "paths.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// `ChunkTransfer` is the reduction of a chunk of the layers of a graph (see
+// above). Its columns are the vertices of the chunk's first layer that edges
+// leave, `sources`, and one more for the paths that begin within the chunk,
+// at vertices that no edge reaches. Its rows are the vertices of the chunk's
+// last layer, `ends`. `costs[end * columns + source]` is the least total
+// weight of a path from the source to the end, or `pruned_total_weight` if
+// there's no such path. The exception is the first chunk of a graph, which
+// has only one column: the total weights of the paths to the ends from the
+// initial costs, and from within the chunk.
+template <typename Weight>
+struct ChunkTransfer {
+  std::vector<int> sources; // by name
+  VertexIndex ends;
+  std::size_t columns = 0;
+  std::vector<TotalWeight<Weight>> costs;
+};
+
+// Reduce the chunk consisting of the non-empty `layers` to `transfer` (see
+// `ChunkTransfer`), with `columns` columns. `start(name, costs)` assigns to
+// `costs[0]` through `costs[columns - 1]` the costs at which paths begin at
+// the vertex `name` of the chunk's first layer, and `fresh` are the costs at
+// which they begin at a vertex of a later layer that no edge reaches.
+template <typename Weight, typename Start>
+void reduce_chunk(
+    std::span<const std::span<const BasicEdge<Weight>>> layers,
+    std::size_t columns,
+    const Start& start,
+    const TotalWeight<Weight> *fresh,
+    ChunkTransfer<Weight>& transfer) {
+  using Total = TotalWeight<Weight>;
+  using std::swap;
+  constexpr Total none = pruned_total_weight<Total>();
+  VertexIndex previous_index;
+  VertexIndex& current_index = transfer.ends;
+  std::vector<Total> previous_costs;
+  std::vector<Total>& current_costs = transfer.costs;
+  for (const BasicEdge<Weight>& edge : layers.front()) {
+    const std::size_t known = previous_index.size();
+    if (previous_index.insert(edge.from) == int(known)) {
+      previous_costs.resize((known + 1) * columns);
+      start(edge.from, previous_costs.data() + known * columns);
+    }
+  }
+  transfer.sources = previous_index.names();
+  transfer.columns = columns;
+
+  for (const std::span<const BasicEdge<Weight>> layer : layers) {
+    current_index.clear();
+    current_costs.clear();
+    for (const auto [from_name, to_name, weight] : layer) {
+      const int from = previous_index.find(from_name);
+      const Total *const from_costs = from >= 0 ? previous_costs.data() + from * columns : fresh;
+      const std::size_t known = current_index.size();
+      const int to = current_index.insert(to_name);
+      if (to == int(known)) {
+        current_costs.resize((known + 1) * columns, none);
+      }
+      Total *const to_costs = current_costs.data() + to * columns;
+      for (std::size_t column = 0; column != columns; ++column) {
+        const Total proposed = from_costs[column] == none ? none : from_costs[column] + weight;
+        to_costs[column] = std::min(to_costs[column], proposed);
+      }
+    }
+    swap(previous_index, current_index);
+    swap(previous_costs, current_costs);
+  }
+  swap(previous_index, current_index);
+  swap(previous_costs, current_costs);
+}
+
+// Return the optimal paths through the non-empty `layers`, where `layers[i]`
+// are the edges of layer `i`, as `CheapestPathsSolver::result` would, or if
+// `k` is positive, the `k` best paths, as `CheapestPathsSolver::best` would.
+// Paths begin and end as the `header` says (see `BasicGraphHeader`). The
+// layers are split into `options.chunks` chunks, which are solved on
+// `options.threads` threads, as described above. Beam search and commits
+// (see `SolveOptions`) aren't supported.
+template <typename PathType = Path>
+std::vector<PathType> chunked_cheapest_paths(
+    std::span<const std::span<const BasicEdge<typename PathType::value_type::weight_type>>> layers,
+    const BasicGraphHeader<typename PathType::value_type::weight_type>& header,
+    std::size_t k,
+    const SolveOptions& options) {
+  using Weight = typename PathType::value_type::weight_type;
+  using Total = TotalWeight<Weight>;
+  using ChunkPath = BasicSharedPath<Weight>;
+  using ChunkSolver = CheapestPathsSolver<ChunkPath>;
+  using TotalCost = typename ChunkSolver::total_cost_type;
+  constexpr Total none = pruned_total_weight<Total>();
+  assert(!layers.empty());
+  assert(!options.on_commit && options.beam_width == 0 &&
+         options.beam_margin == std::numeric_limits<double>::infinity());
+
+  const std::size_t chunks = std::clamp<std::size_t>(options.chunks, 1, layers.size());
+  if (chunks == 1) {
+    CheapestPathsSolver<PathType> solver{options};
+    solver.set_initial_costs(header.initial);
+    solver.set_terminal_costs(header.terminal);
+    for (const std::span<const BasicEdge<Weight>> layer : layers) {
+      solver.push_layer(layer);
+    }
+    return k ? solver.best(k) : solver.result();
+  }
+  // Chunk `i` is the layers `[boundaries[i], boundaries[i + 1])`.
+  std::vector<std::size_t> boundaries;
+  for (std::size_t i = 0; i <= chunks; ++i) {
+    boundaries.push_back(layers.size() * i / chunks);
+  }
+  const auto chunk_layers = [&](std::size_t chunk) {
+    return layers.subspan(boundaries[chunk], boundaries[chunk + 1] - boundaries[chunk]);
+  };
+  const int threads = int(std::min<std::size_t>(std::max(options.threads, 1), chunks));
+  // Invoke `work(chunk)` for each chunk, on `threads` threads.
+  const auto for_each_chunk = [&](const auto& work) {
+    std::atomic<std::size_t> next_chunk = 0;
+    run_on_threads(threads, [&](int) {
+      for (std::size_t chunk; (chunk = next_chunk++) < chunks;) {
+        work(chunk);
+      }
+    });
+  };
+
+  // First, reduce the chunks. The vertices of the first layer begin paths at
+  // their initial costs, if there are any, or else at zero.
+  std::vector<ChunkTransfer<Weight>> transfers(chunks);
+  for_each_chunk([&](std::size_t chunk) {
+    if (chunk == 0) {
+      VertexIndex initial_index;
+      std::vector<Total> initial_costs;
+      for (const BasicVertexCost<Weight>& initial : header.initial) {
+        const std::size_t known = initial_index.size();
+        if (initial_index.insert(initial.vertex) == int(known)) {
+          initial_costs.emplace_back();
+        }
+        initial_costs[initial_index.find(initial.vertex)] = initial.cost; // the last one counts
+      }
+      const Total fresh = 0;
+      reduce_chunk<Weight>(chunk_layers(0), 1, [&](int name, Total *costs) {
+        const int initial = initial_index.find(name);
+        costs[0] = initial >= 0 ? initial_costs[initial] : header.initial.empty() ? 0 : none;
+      }, &fresh, transfers[0]);
+      return;
+    }
+    // Otherwise, each source is a column of its own, in order of appearance,
+    // and the last column is for the paths that begin within the chunk.
+    VertexIndex first_layer;
+    for (const BasicEdge<Weight>& edge : chunk_layers(chunk).front()) {
+      first_layer.insert(edge.from);
+    }
+    const std::size_t sources = first_layer.size();
+    std::vector<Total> fresh(sources + 1, none);
+    fresh[sources] = 0;
+    std::size_t source = 0;
+    reduce_chunk<Weight>(chunk_layers(chunk), sources + 1, [&](int, Total *costs) {
+      std::fill(costs, costs + sources + 1, none);
+      costs[source++] = 0;
+    }, fresh.data(), transfers[chunk]);
+  });
+
+  // Then find the total weights at the boundaries, in order. `starts[chunk]`
+  // are the total weights at which paths begin at `transfers[chunk].sources`,
+  // which are zero at vertices that no edge reaches.
+  std::vector<std::vector<Total>> starts(chunks);
+  std::vector<Total> ends = std::move(transfers[0].costs);
+  for (std::size_t chunk = 1; chunk != chunks; ++chunk) {
+    const ChunkTransfer<Weight>& before = transfers[chunk - 1];
+    ChunkTransfer<Weight>& transfer = transfers[chunk];
+    for (const int source : transfer.sources) {
+      const int end = before.ends.find(source);
+      starts[chunk].push_back(end >= 0 ? ends[end] : 0);
+    }
+    const std::size_t sources = transfer.sources.size();
+    ends.assign(transfer.ends.size(), none);
+    for (std::size_t end = 0; end != ends.size(); ++end) {
+      const Total *const costs = transfer.costs.data() + end * transfer.columns;
+      Total least = costs[sources];
+      for (std::size_t source = 0; source != sources; ++source) {
+        if (starts[chunk][source] != none && costs[source] != none) {
+          least = std::min(least, starts[chunk][source] + costs[source]);
+        }
+      }
+      ends[end] = least;
+    }
+    transfer.costs = {}; // it's not needed anymore
+  }
+
+  // Then solve each chunk from the total weights at its first boundary, and
+  // keep the paths to each vertex of its last layer, in order of vertex, or
+  // for the last chunk, the paths asked for.
+  std::vector<std::vector<ChunkPath>> paths(chunks);
+  SolveOptions chunk_options = options;
+  chunk_options.threads = 1;
+  chunk_options.metrics = nullptr; // the chunks are solved at the same time
+  for_each_chunk([&](std::size_t chunk) {
+    ChunkSolver solver{chunk_options};
+    if (chunk == 0) {
+      solver.set_initial_costs(header.initial);
+    } else {
+      // A source that no path reaches gets `pruned_total_weight`, which is
+      // how the solver marks a vertex that's as if pruned.
+      std::vector<TotalCost> initial;
+      for (std::size_t source = 0; source != starts[chunk].size(); ++source) {
+        initial.push_back(TotalCost{.vertex = transfers[chunk].sources[source], .cost = starts[chunk][source]});
+      }
+      solver.set_initial_totals(initial);
+    }
+    for (const std::span<const BasicEdge<Weight>> layer : chunk_layers(chunk)) {
+      solver.push_layer(layer);
+    }
+    if (chunk == chunks - 1) {
+      solver.set_terminal_costs(header.terminal);
+      paths[chunk] = k ? solver.best(k) : solver.result();
+      return;
+    }
+    paths[chunk] = solver.best(std::numeric_limits<std::size_t>::max());
+    std::sort(paths[chunk].begin(), paths[chunk].end(), [](const ChunkPath& left, const ChunkPath& right) {
+      return left.head().vertex < right.head().vertex;
+    });
+  });
+
+  // Finally, trace each of the last chunk's paths back through the paths of
+  // the chunks before it. A path that begins at the first layer of its chunk,
+  // at a vertex that a path of the chunk before reaches, continues that path.
+  // Each node of the chunks' paths is copied at most once, so that the results
+  // share their common prefixes as usual.
+  using State = typename PathType::value_type;
+  std::unordered_map<std::uintptr_t, PathType> copies; // by node id
+  struct Link {
+    std::size_t chunk;
+    const ChunkPath *path;
+    std::size_t uncopied = 0; // the number of nodes before the first copied
+  };
+  std::vector<Link> links;
+  std::vector<State> states;
+  std::vector<std::uintptr_t> ids;
+  const auto trace = [&](const ChunkPath& path) {
+    // Find the paths that `path` continues, back to one with a node that's
+    // been copied already, or that begins where there's nothing to continue.
+    links.assign(1, Link{.chunk = chunks - 1, .path = &path});
+    PathType result;
+    for (;;) {
+      Link& link = links.back();
+      int first = -1;
+      bool copied = false;
+      for (auto node = link.path->begin(); node != link.path->end(); ++node) {
+        if (const auto found = copies.find(node.id()); found != copies.end()) {
+          result = found->second;
+          copied = true;
+          break;
+        }
+        ++link.uncopied;
+        first = node->vertex;
+      }
+      if (copied || !link.chunk || link.uncopied != chunk_layers(link.chunk).size() + 1) {
+        break; // it begins within the chunk
+      }
+      const std::vector<ChunkPath>& before = paths[link.chunk - 1];
+      const auto found = std::lower_bound(before.begin(), before.end(), first, [](const ChunkPath& path, int vertex) {
+        return path.head().vertex < vertex;
+      });
+      if (found == before.end() || found->head().vertex != first) {
+        break;
+      }
+      links.push_back(Link{.chunk = link.chunk - 1, .path = &*found});
+    }
+    // Then copy them, oldest first. A path's first vertex is the last vertex
+    // of the path it continues, if any, and so that node is the copy of the
+    // head of the path it continues.
+    for (auto link = links.rbegin(); link != links.rend(); ++link) {
+      states.clear();
+      ids.clear();
+      auto node = link->path->begin();
+      for (std::size_t i = 0; i != link->uncopied; ++i, ++node) {
+        states.push_back(*node);
+        ids.push_back(node.id());
+      }
+      const bool continues = link != links.rbegin();
+      for (std::size_t i = states.size(); i--;) {
+        if (!(continues && i == states.size() - 1)) {
+          result = std::move(result).prepend(states[i]);
+        }
+        copies.emplace(ids[i], result);
+      }
+    }
+    return result;
+  };
+  std::vector<PathType> result;
+  for (const ChunkPath& path : paths[chunks - 1]) {
+    result.push_back(trace(path));
+  }
+  return result;
+}
@@ -0,0 +1,115 @@
+// `DotWriter` prints the Graphviz output of `shortestpath`. A graph with
+// hundreds of millions of edges makes for gigabytes of DOT, so rather than
+// going through `std::ostream` one field at a time, `DotWriter` collects text
+// in a large buffer and hands it to a `std::streambuf` in big chunks. Numbers
+// are formatted using `std::to_chars`, which neither allocates nor consults
+// the locale, but produces the same text as `std::ostream` does by default.
+//
+// Graphviz node names are of the form "node_LAYER_VERTEX". `DotNodePrefix` is
+// the "node_LAYER_" part, formatted once for all of the nodes of a layer.
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <streambuf>
+#include <string_view>
+#include <vector>
+
+class DotNodePrefix {
+  char text[32];
+  std::size_t size;
+
+ public:
+  explicit DotNodePrefix(int layer) {
+    const std::string_view node = "node_";
+    char *end = std::copy(node.begin(), node.end(), text);
+    end = std::to_chars(end, text + sizeof text - 1, layer).ptr;
+    *end++ = '_';
+    size = end - text;
+  }
+
+  std::string_view view() const {
+    return std::string_view{text, size};
+  }
+};
+
+class DotWriter {
+  std::streambuf *destination;
+  std::vector<char> buffer;
+  std::size_t used = 0;
+
+  // Room for the longest number we write, which is a `double` formatted with
+  // six significant digits, e.g. "-1.23457e+308".
+  static constexpr std::size_t max_number_size = 32;
+
+  char *reserve(std::size_t size) {
+    if (buffer.size() - used < size) {
+      flush();
+    }
+    return buffer.data() + used;
+  }
+
+ public:
+  explicit DotWriter(std::streambuf *destination)
+  : destination(destination)
+  , buffer(1 << 20) {
+  }
+
+  DotWriter(const DotWriter&) = delete;
+  DotWriter& operator=(const DotWriter&) = delete;
+
+  ~DotWriter() {
+    flush();
+  }
+
+  void flush() {
+    destination->sputn(buffer.data(), used);
+    used = 0;
+  }
+
+  DotWriter& operator<<(std::string_view text) {
+    if (text.size() > buffer.size()) {
+      flush();
+      destination->sputn(text.data(), text.size());
+      return *this;
+    }
+    char *const begin = reserve(text.size());
+    std::copy(text.begin(), text.end(), begin);
+    used += text.size();
+    return *this;
+  }
+
+  DotWriter& operator<<(const char *text) {
+    return *this << std::string_view{text};
+  }
+
+  DotWriter& operator<<(char character) {
+    *reserve(1) = character;
+    ++used;
+    return *this;
+  }
+
+  DotWriter& operator<<(const DotNodePrefix& prefix) {
+    return *this << prefix.view();
+  }
+
+  template <std::integral Integer>
+  DotWriter& operator<<(Integer value) {
+    char *const begin = reserve(max_number_size);
+    used += std::to_chars(begin, begin + max_number_size, value).ptr - begin;
+    return *this;
+  }
+
+  // Print `value` as `std::ostream` does by default, i.e. with six
+  // significant digits, like `printf("%g", value)`.
+  template <std::floating_point Float>
+  DotWriter& operator<<(Float value) {
+    char *const begin = reserve(max_number_size);
+    used += std::to_chars(
+      begin, begin + max_number_size, value, std::chars_format::general, 6).ptr - begin;
+    return *this;
+  }
+};
@@ -0,0 +1,197 @@
+// A layered graph is a sequence of layers, where each layer is a sequence of
+// `Edge`s from the vertices of the previous layer to the vertices of the
+// current layer.
+//
+// In the text format, each line is a layer, and each layer is a sequence of
+// whitespace separated `from to weight` triples, e.g.
+//
+//     0 0 5    1 0 4    2 1 3
+//     0 1 6    1 0 10   1 1 9
+//
+// `parse_layer` parses one such line.
+//
+// Edge weights are `double`s by default. `BasicEdge<Weight>` is an edge whose
+// weight is some other arithmetic type, such as `float` or `std::int32_t`,
+// which makes for smaller edges, and for integers, exact arithmetic.
+//
+// Paths begin at any vertex of the first layer at total weight zero, and end
+// at any vertex of the last layer. A graph can say otherwise in header lines
+// before its first layer: a line beginning with "#initial" lists `vertex cost`
+// pairs, and paths begin only at those vertices of the first layer, at those
+// total weights. Likewise, a line beginning with "#terminal" lists the only
+// vertices of the last layer at which paths end, and the cost of ending at
+// each, e.g.
+//
+//     #initial 0 0    1 2.5
+//     #terminal 0 10    1 0
+//     0 0 5    1 0 4
+//     0 1 6    1 0 10   1 1 9
+//
+// `parse_graph_header` parses one such line into a `BasicGraphHeader`.
+//
+// A batch of graphs is a sequence of graphs in the text format, separated by
+// lines for which `is_graph_separator` is true: blank lines, or lines that
+// begin with "#graph", e.g.
+//
+//     #graph first
+//     0 0 5    1 0 4
+//     0 1 6    0 0 10
+//     #graph second
+//     0 0 1    0 1 2
+
+#pragma once
+
+#include "linereader.h"
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename Weight>
+struct BasicEdge {
+  int from; // vertex name, `>= 0`
+  int to; // vertex name, `>= 0`
+  Weight weight;
+};
+
+using Edge = BasicEdge<double>;
+
+// the cost of beginning or ending a path at a vertex
+template <typename Weight>
+struct BasicVertexCost {
+  int vertex; // vertex name, `>= 0`
+  Weight cost;
+};
+
+template <typename Weight>
+struct BasicGraphHeader {
+  // If `initial` is not empty, then paths begin only at its vertices of the
+  // first layer, at their costs. If `terminal` is not empty, then paths end
+  // only at its vertices of the last layer, and their costs are added.
+  std::vector<BasicVertexCost<Weight>> initial;
+  std::vector<BasicVertexCost<Weight>> terminal;
+  // whether a header line couldn't be parsed, in which case the graph is
+  // malformed, and its layers aren't read
+  bool malformed = false;
+
+  void clear() {
+    initial.clear();
+    terminal.clear();
+    malformed = false;
+  }
+};
+
+// Return whether the specified `line` is a graph header line, i.e. whether it
+// begins with "#initial" or "#terminal".
+inline bool is_graph_header(std::string_view line) {
+  for (const std::string_view keyword : {"#initial", "#terminal"}) {
+    if (line.starts_with(keyword) &&
+        (line.size() == keyword.size() || is_space(line[keyword.size()]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Return whether the specified `line` separates one graph from the next in a
+// batch of graphs.
+inline bool is_graph_separator(std::string_view line) {
+  if (line.starts_with("#graph")) {
+    return true;
+  }
+  for (const char character : line) {
+    if (!is_space(character)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Append to `destination` the edges parsed from the specified `line`. Return
+// `true` if the line ended where an edge could begin, or `false` if the line
+// ended partway through an edge (in which case the layer is incomplete and,
+// by convention, so is the input). If `Weight` is an integer type, then a
+// weight that isn't an integer, e.g. "2.5", counts as a partial edge, rather
+// than as the edge "2" followed by who knows what.
+template <typename Weight>
+bool parse_layer(std::string_view line, std::vector<BasicEdge<Weight>>& destination) {
+  const char *cursor = line.data();
+  const char *const end = cursor + line.size();
+  int from;
+  int to;
+  Weight weight;
+  for (;;) {
+    if (!parse_field(cursor, end, from)) {
+      return true;
+    }
+    if (!parse_field(cursor, end, to) || !parse_field(cursor, end, weight)) {
+      return false;
+    }
+    if constexpr (std::is_integral_v<Weight>) {
+      if (cursor != end && !is_space(*cursor)) {
+        return false;
+      }
+    }
+    destination.push_back(BasicEdge<Weight>{.from = from, .to = to, .weight = weight});
+  }
+}
+
+// Append the `vertex cost` pairs of the specified graph header `line` (see
+// `is_graph_header`) to `header.initial` or `header.terminal`, whichever the
+// line is for. Return `false` if the line ends partway through a pair, or if
+// it isn't a header line.
+template <typename Weight>
+bool parse_graph_header(std::string_view line, BasicGraphHeader<Weight>& header) {
+  if (!is_graph_header(line)) {
+    return false;
+  }
+  const bool initial = line.starts_with("#initial");
+  std::vector<BasicVertexCost<Weight>>& destination = initial ? header.initial : header.terminal;
+  const char *cursor = line.data() + (initial ? 8 : 9);
+  const char *const end = line.data() + line.size();
+  int vertex;
+  Weight cost;
+  for (;;) {
+    if (!parse_field(cursor, end, vertex)) {
+      return true;
+    }
+    if (!parse_field(cursor, end, cost)) {
+      return false;
+    }
+    if constexpr (std::is_integral_v<Weight>) {
+      if (cursor != end && !is_space(*cursor)) {
+        return false;
+      }
+    }
+    destination.push_back(BasicVertexCost<Weight>{.vertex = vertex, .cost = cost});
+  }
+}
+
+// `VectorLayerIterator` presents layers that are already in memory as a
+// layer range for `cheapest_paths`.
+template <typename Weight>
+class BasicVectorLayerIterator {
+  using Layer = std::vector<BasicEdge<Weight>>;
+
+  typename std::vector<Layer>::const_iterator layer;
+
+ public:
+  BasicVectorLayerIterator() = default;
+  explicit BasicVectorLayerIterator(typename std::vector<Layer>::const_iterator layer)
+  : layer(layer) {
+  }
+
+  BasicVectorLayerIterator& operator++() {
+    ++layer;
+    return *this;
+  }
+
+  std::pair<typename Layer::const_iterator, typename Layer::const_iterator>
+  operator*() const {
+    return std::make_pair(layer->begin(), layer->end());
+  }
+
+  bool operator==(const BasicVectorLayerIterator&) const = default;
+};
+
+using VectorLayerIterator = BasicVectorLayerIterator<double>;
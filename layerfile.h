@@ -0,0 +1,329 @@
+// A layer file is a compact binary representation of a layered graph (see
+// `layer.h`) that can be memory mapped and used in place, without parsing.
+//
+// The layout of a layer file is:
+//
+//     LayerFileHeader header;
+//     Record          records[header.edge_count];
+//     (zero padding up to a multiple of 8 bytes)
+//     std::uint64_t   offsets[header.layer_count + 1];
+//
+// where `records` begins immediately after the header, and `offsets` begins at
+// `header.offsets_position`. The records of layer `i` (counting from zero) are
+// `[records + offsets[i], records + offsets[i + 1])`. `Record` depends on
+// `header.encoding`:
+//
+// - `LayerFileEncoding::edge_f64` records are `Edge`s.
+// - `LayerFileEncoding::edge_f32` records are `QuantizedEdge`s, which store
+//   the weight as a `float`. They're 25% smaller, but the weights lose
+//   precision.
+// - `LayerFileEncoding::edge_i32` records are `BasicEdge<std::int32_t>`s, for
+//   graphs whose weights are integers. They're as small as `QuantizedEdge`s,
+//   and exact.
+//
+// In every case, the records are `BasicEdge`s, and can be handed out directly
+// from the mapped memory.
+//
+// All integers are in host byte order. `header.byte_order` is used to reject
+// files written on a machine of different endianness.
+//
+// `LayerFileWriter` writes a layer file one layer at a time, and
+// `MappedLayerFile` maps one into memory.
+
+#pragma once
+
+#include "layer.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum class LayerFileEncoding : std::uint32_t {
+  edge_f64 = 1,
+  edge_f32 = 2,
+  edge_i32 = 3
+};
+
+struct LayerFileHeader {
+  char magic[8]; // `layer_file_magic`
+  std::uint32_t byte_order; // `layer_file_byte_order`, as written
+  std::uint32_t version; // `layer_file_version`
+  std::uint32_t encoding; // a `LayerFileEncoding`
+  std::uint32_t reserved; // zero
+  std::uint64_t layer_count;
+  std::uint64_t edge_count;
+  std::uint64_t offsets_position; // in bytes from the beginning of the file
+};
+
+constexpr char layer_file_magic[8] = {'S', 'P', 'L', 'A', 'Y', 'E', 'R', 'S'};
+constexpr std::uint32_t layer_file_byte_order = 0x01020304;
+constexpr std::uint32_t layer_file_version = 1;
+
+using QuantizedEdge = BasicEdge<float>;
+
+// The records are used in place, so their layout is part of the format.
+static_assert(sizeof(LayerFileHeader) == 48);
+static_assert(sizeof(Edge) == 16 && alignof(Edge) <= 8);
+static_assert(sizeof(QuantizedEdge) == 12);
+static_assert(sizeof(BasicEdge<std::int32_t>) == 12);
+
+// Return the size of a record having the specified `encoding`, or zero if
+// `encoding` isn't one we know.
+inline std::size_t layer_file_record_size(LayerFileEncoding encoding) {
+  switch (encoding) {
+  case LayerFileEncoding::edge_f64:
+    return sizeof(Edge);
+  case LayerFileEncoding::edge_f32:
+    return sizeof(QuantizedEdge);
+  case LayerFileEncoding::edge_i32:
+    return sizeof(BasicEdge<std::int32_t>);
+  }
+  return 0;
+}
+
+class LayerFileWriter {
+  std::ostream& output;
+  LayerFileEncoding encoding;
+  std::vector<std::uint64_t> offsets;
+  std::vector<char> records_scratch;
+
+  // Write `edges` as records of type `BasicEdge<RecordWeight>`.
+  template <typename RecordWeight, typename Weight>
+  void write_records(const std::vector<BasicEdge<Weight>>& edges);
+
+ public:
+  // Begin writing a layer file to `output`, which must be seekable (e.g. a
+  // regular file), since the header is written last.
+  LayerFileWriter(std::ostream& output, LayerFileEncoding encoding);
+
+  // Append the specified `edges` as the next layer, converting their weights
+  // to the type of the encoding if need be.
+  template <typename Weight>
+  void write_layer(const std::vector<BasicEdge<Weight>>& edges);
+
+  // Write the offsets and the header. Return whether all output succeeded.
+  bool finish();
+};
+
+class MappedLayerFile {
+  void *address;
+  std::size_t size;
+  const LayerFileHeader *header;
+  const std::uint64_t *offsets;
+  const unsigned char *records;
+
+  MappedLayerFile() = default;
+
+ public:
+  MappedLayerFile(const MappedLayerFile&) = delete;
+  MappedLayerFile& operator=(const MappedLayerFile&) = delete;
+  ~MappedLayerFile();
+
+  // Return whether the file open as `fd` begins with a layer file header.
+  // The file offset of `fd` is not changed, and `fd` need not be seekable.
+  static bool is_layer_file(int fd);
+
+  // Map into memory the layer file open as `fd`. Return null and assign a
+  // diagnostic to `error` if `fd` can't be mapped or isn't a valid layer file.
+  static std::unique_ptr<MappedLayerFile> map(int fd, std::string& error);
+
+  LayerFileEncoding encoding() const;
+  std::size_t layer_count() const;
+
+  // Return all of the records in the file. The behavior is undefined unless
+  // `Record` is the type of record indicated by `encoding()`.
+  template <typename Record>
+  std::span<const Record> all_records() const;
+
+  // Return the range of record indices `[begin, end)` belonging to the layer
+  // at the specified zero-based `index`.
+  std::pair<std::size_t, std::size_t> layer_bounds(std::size_t index) const;
+};
+
+// Implementation
+// ==============
+
+// class LayerFileWriter
+// ---------------------
+inline LayerFileWriter::LayerFileWriter(
+    std::ostream& output,
+    LayerFileEncoding encoding)
+: output(output)
+, encoding(encoding)
+, offsets{0} {
+  // Reserve space for the header. We'll fill it in `finish`.
+  const LayerFileHeader placeholder{};
+  output.write(reinterpret_cast<const char*>(&placeholder), sizeof placeholder);
+}
+
+template <typename Weight>
+void LayerFileWriter::write_layer(const std::vector<BasicEdge<Weight>>& edges) {
+  switch (encoding) {
+  case LayerFileEncoding::edge_f64:
+    write_records<double>(edges);
+    break;
+  case LayerFileEncoding::edge_f32:
+    write_records<float>(edges);
+    break;
+  case LayerFileEncoding::edge_i32:
+    write_records<std::int32_t>(edges);
+  }
+  offsets.push_back(offsets.back() + edges.size());
+}
+
+template <typename RecordWeight, typename Weight>
+void LayerFileWriter::write_records(const std::vector<BasicEdge<Weight>>& edges) {
+  using Record = BasicEdge<RecordWeight>;
+  if constexpr (std::is_same_v<RecordWeight, Weight>) {
+    output.write(
+      reinterpret_cast<const char*>(edges.data()),
+      edges.size() * sizeof(Record));
+  } else {
+    records_scratch.resize(edges.size() * sizeof(Record));
+    char *record_bytes = records_scratch.data();
+    for (const BasicEdge<Weight>& edge : edges) {
+      const Record record{
+        .from = edge.from,
+        .to = edge.to,
+        .weight = RecordWeight(edge.weight)
+      };
+      std::memcpy(record_bytes, &record, sizeof record);
+      record_bytes += sizeof record;
+    }
+    output.write(records_scratch.data(), records_scratch.size());
+  }
+}
+
+inline bool LayerFileWriter::finish() {
+  const std::size_t record_size = layer_file_record_size(encoding);
+  const std::uint64_t records_end =
+    sizeof(LayerFileHeader) + offsets.back() * record_size;
+  const std::uint64_t offsets_position = (records_end + 7) / 8 * 8;
+  const char padding[8] = {};
+  output.write(padding, offsets_position - records_end);
+  output.write(
+    reinterpret_cast<const char*>(offsets.data()),
+    offsets.size() * sizeof offsets[0]);
+
+  LayerFileHeader header{};
+  std::memcpy(header.magic, layer_file_magic, sizeof header.magic);
+  header.byte_order = layer_file_byte_order;
+  header.version = layer_file_version;
+  header.encoding = std::uint32_t(encoding);
+  header.layer_count = offsets.size() - 1;
+  header.edge_count = offsets.back();
+  header.offsets_position = offsets_position;
+  output.seekp(0);
+  output.write(reinterpret_cast<const char*>(&header), sizeof header);
+  output.flush();
+  return bool(output);
+}
+
+// class MappedLayerFile
+// ---------------------
+inline MappedLayerFile::~MappedLayerFile() {
+  ::munmap(address, size);
+}
+
+inline bool MappedLayerFile::is_layer_file(int fd) {
+  char magic[sizeof layer_file_magic];
+  return ::pread(fd, magic, sizeof magic, 0) == sizeof magic &&
+    std::memcmp(magic, layer_file_magic, sizeof magic) == 0;
+}
+
+inline std::unique_ptr<MappedLayerFile> MappedLayerFile::map(
+    int fd,
+    std::string& error) {
+  struct stat status;
+  if (::fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+    error = "a layer file must be a regular file";
+    return nullptr;
+  }
+  const std::size_t size = status.st_size;
+  if (size < sizeof(LayerFileHeader)) {
+    error = "file is too small to be a layer file";
+    return nullptr;
+  }
+  void *const address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (address == MAP_FAILED) {
+    error = "unable to map the layer file into memory";
+    return nullptr;
+  }
+  std::unique_ptr<MappedLayerFile> file{new MappedLayerFile};
+  file->address = address;
+  file->size = size;
+  file->header = static_cast<const LayerFileHeader*>(address);
+  file->records = static_cast<const unsigned char*>(address) + sizeof(LayerFileHeader);
+
+  const LayerFileHeader& header = *file->header;
+  if (std::memcmp(header.magic, layer_file_magic, sizeof header.magic) != 0) {
+    error = "not a layer file";
+    return nullptr;
+  }
+  if (header.byte_order != layer_file_byte_order) {
+    error = "layer file was written with a different byte order";
+    return nullptr;
+  }
+  if (header.version != layer_file_version) {
+    error = "unsupported layer file version " + std::to_string(header.version);
+    return nullptr;
+  }
+  const std::size_t record_size = layer_file_record_size(LayerFileEncoding(header.encoding));
+  if (record_size == 0) {
+    error = "unknown layer file encoding " + std::to_string(header.encoding);
+    return nullptr;
+  }
+  const std::uint64_t max_count = size / 8; // generous, but avoids overflow
+  if (header.edge_count > max_count || header.layer_count > max_count ||
+      header.offsets_position % 8 != 0 ||
+      header.offsets_position < sizeof header + header.edge_count * record_size ||
+      header.offsets_position > size ||
+      (size - header.offsets_position) / 8 < header.layer_count + 1) {
+    error = "layer file is truncated or its header is corrupt";
+    return nullptr;
+  }
+  file->offsets = reinterpret_cast<const std::uint64_t*>(
+    static_cast<const unsigned char*>(address) + header.offsets_position);
+  if (file->offsets[0] != 0 || file->offsets[header.layer_count] != header.edge_count) {
+    error = "layer file offsets are corrupt";
+    return nullptr;
+  }
+  for (std::uint64_t i = 0; i < header.layer_count; ++i) {
+    if (file->offsets[i] > file->offsets[i + 1]) {
+      error = "layer file offsets are corrupt";
+      return nullptr;
+    }
+  }
+
+  return file;
+}
+
+inline LayerFileEncoding MappedLayerFile::encoding() const {
+  return LayerFileEncoding(header->encoding);
+}
+
+inline std::size_t MappedLayerFile::layer_count() const {
+  return header->layer_count;
+}
+
+template <typename Record>
+std::span<const Record> MappedLayerFile::all_records() const {
+  return std::span<const Record>(
+    reinterpret_cast<const Record*>(records),
+    header->edge_count);
+}
+
+inline std::pair<std::size_t, std::size_t> MappedLayerFile::layer_bounds(
+    std::size_t index) const {
+  return {offsets[index], offsets[index + 1]};
+}
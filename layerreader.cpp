@@ -0,0 +1,191 @@
+#include "layerreader.h"
+#include <cstdint>
+#include <string_view>
+
+void print_layer_subgraph(
+    int layer,
+    const std::vector<int>& vertices,
+    DotWriter& graphviz) {
+  graphviz <<
+    "\n"
+    "  subgraph cluster_" << layer << " {\n"
+    "    style=filled;\n"
+    "    color=lightgrey;\n"
+    "    node [style=filled, color=white];\n"
+    "    label = \"Layer " << layer << "\";\n"
+    "\n";
+  const DotNodePrefix node{layer};
+  for (const int vertex : vertices) {
+    graphviz <<
+    "    " << node << vertex << " [label=\"" << vertex << "\"];\n";
+  }
+  graphviz <<
+    "  }\n";
+}
+
+template <typename Weight>
+bool read_layer(
+    LineReader& lines,
+    std::vector<BasicEdge<Weight>>& destination,
+    BasicGraphHeader<Weight>& header,
+    DotWriter *graphviz,
+    DistinctVertices& vertices_scratch,
+    int layer) {
+  destination.clear();
+
+  std::string_view line;
+  if (!lines.next_line(line)) {
+    return false;
+  }
+  if (layer == 1) {
+    header.clear();
+    while (is_graph_header(line)) {
+      if (!parse_graph_header(line, header)) {
+        header.malformed = true;
+        return false;
+      }
+      if (!lines.next_line(line)) {
+        return false;
+      }
+    }
+  }
+
+  if (!parse_layer(line, destination)) {
+    return false;
+  }
+
+  if (graphviz) {
+    print_layer_graph(layer, destination, vertices_scratch, *graphviz);
+  }
+
+  return true;
+}
+
+template <typename Weight>
+bool read_batch_layer(BasicLayerGeneratorState<Weight>& state) {
+  std::string_view line;
+  do {
+    if (!state.input.next_line(line)) {
+      state.exhausted = true;
+      return false;
+    }
+    if (is_graph_separator(line)) {
+      state.skipping = false;
+      return false;
+    }
+  } while (state.skipping);
+  state.present = true;
+
+  if (state.layer == 1) {
+    while (is_graph_header(line)) {
+      if (!parse_graph_header(line, state.header)) {
+        state.header.malformed = true;
+        state.malformed = true;
+        state.skipping = true;
+        return false;
+      }
+      if (!state.input.next_line(line)) {
+        state.exhausted = true;
+        return false;
+      }
+      if (is_graph_separator(line)) {
+        return false;
+      }
+    }
+  }
+
+  state.incoming.clear();
+  if (!parse_layer(line, state.incoming)) {
+    state.malformed = true;
+    state.skipping = true;
+    return false;
+  }
+  return true;
+}
+
+// class BasicLayerPipeline<Weight>
+// --------------------------------
+template <typename Weight>
+BasicLayerPipeline<Weight>::BasicLayerPipeline(
+    std::istream& input,
+    DotWriter *graphviz,
+    std::size_t depth)
+: slots(std::max<std::size_t>(depth, 1))
+, slot_offsets(slots.size())
+, input(input)
+, graphviz(graphviz)
+, producer([this](std::stop_token stop) { produce(stop); }) {
+}
+
+template <typename Weight>
+void BasicLayerPipeline<Weight>::produce(std::stop_token stop) {
+  for (int layer = 1;; ++layer) {
+    std::size_t slot;
+    {
+      std::unique_lock lock{mutex};
+      if (!slot_free.wait(lock, stop, [&] { return ready < slots.size(); })) {
+        break; // stop requested
+      }
+      slot = (head + ready) % slots.size();
+    }
+    // The consumer doesn't touch `slots[slot]` until we say it's ready, so we
+    // can fill it without holding the lock.
+    if (!read_layer(input, slots[slot], graph_header, graphviz, vertices_scratch, layer)) {
+      break;
+    }
+    slot_offsets[slot] = input.offset();
+    std::lock_guard lock{mutex};
+    ++ready;
+    layer_ready.notify_one();
+  }
+
+  std::lock_guard lock{mutex};
+  finished = true;
+  layer_ready.notify_one();
+}
+
+template <typename Weight>
+const std::vector<BasicEdge<Weight>> *BasicLayerPipeline<Weight>::acquire() {
+  std::unique_lock lock{mutex};
+  layer_ready.wait(lock, [&] { return ready != 0 || finished; });
+  if (ready == 0) {
+    return nullptr;
+  }
+  return &slots[head];
+}
+
+template <typename Weight>
+const BasicGraphHeader<Weight>& BasicLayerPipeline<Weight>::header() const {
+  return graph_header;
+}
+
+template <typename Weight>
+std::uint64_t BasicLayerPipeline<Weight>::offset() const {
+  return slot_offsets[head];
+}
+
+template <typename Weight>
+void BasicLayerPipeline<Weight>::release() {
+  {
+    std::lock_guard lock{mutex};
+    assert(ready != 0);
+    head = (head + 1) % slots.size();
+    --ready;
+  }
+  slot_free.notify_one();
+}
+
+// Instantiations
+// --------------
+template bool read_layer(
+    LineReader&, std::vector<BasicEdge<double>>&, BasicGraphHeader<double>&, DotWriter*, DistinctVertices&, int);
+template bool read_layer(
+    LineReader&, std::vector<BasicEdge<float>>&, BasicGraphHeader<float>&, DotWriter*, DistinctVertices&, int);
+template bool read_layer(
+    LineReader&, std::vector<BasicEdge<std::int32_t>>&, BasicGraphHeader<std::int32_t>&, DotWriter*, DistinctVertices&, int);
+template bool read_batch_layer(BasicLayerGeneratorState<double>&);
+template bool read_batch_layer(BasicLayerGeneratorState<float>&);
+template bool read_batch_layer(BasicLayerGeneratorState<std::int32_t>&);
+template class BasicLayerPipeline<double>;
+template class BasicLayerPipeline<float>;
+template class BasicLayerPipeline<std::int32_t>;
@@ -0,0 +1,523 @@
+// `layerreader.h` provides the ways of reading a layered graph (see
+// `layer.h`) one layer at a time, as the layer ranges that `cheapest_paths`
+// consumes:
+//
+// - `LayerIterator` parses the text format from a `std::istream`.
+// - `PipelinedLayerIterator` does the same, but parses ahead on another
+//   thread (see `LayerPipeline`).
+// - `LayerFileIterator` reads a memory mapped layer file (see `layerfile.h`).
+//
+// Each can also print the graph in Graphviz format as it goes.
+//
+// The text readers are class templates over the type of the edge weights (see
+// `BasicEdge`), and are instantiated in the library for `double`, `float`, and
+// `std::int32_t`. `LayerIterator` and friends are the ones for `double`.
+
+#pragma once
+
+#include "dotwriter.h"
+#include "layer.h"
+#include "layerfile.h"
+#include "linereader.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Print the Graphviz cluster for the `vertices` of the specified `layer`.
+void print_layer_subgraph(
+    int layer,
+    const std::vector<int>& vertices,
+    DotWriter& graphviz);
+
+
+// `DistinctVertices` lists the distinct `from` or `to` vertices of a layer in
+// increasing order, for its Graphviz cluster. Rather than sorting the vertices
+// of all of the edges, it marks them in a bitmap that spans the layer's range
+// of vertex names, and then reads the bitmap in order, which takes time
+// linear in the number of edges. The bitmap is reused from one layer to the
+// next. If the names are too spread out for that, e.g. one vertex is named 0
+// and another 2,000,000,000, then it sorts them after all.
+class DistinctVertices {
+  std::vector<std::uint64_t> bits;
+  std::vector<int> vertices;
+
+ public:
+  // Return the distinct `vertex(edge)` of the `edges`, in increasing order.
+  // The result is valid until the next call.
+  template <typename Edges, typename Vertex>
+  const std::vector<int>& of(const Edges& edges, Vertex vertex) {
+    vertices.clear();
+    int low = std::numeric_limits<int>::max();
+    int high = std::numeric_limits<int>::min();
+    std::size_t count = 0;
+    for (const auto& edge : edges) {
+      low = std::min(low, vertex(edge));
+      high = std::max(high, vertex(edge));
+      ++count;
+    }
+    if (count == 0) {
+      return vertices;
+    }
+
+    const std::size_t words = (std::uint64_t(std::int64_t(high) - low) >> 6) + 1;
+    if (words > count + 1024) {
+      for (const auto& edge : edges) {
+        vertices.push_back(vertex(edge));
+      }
+      std::sort(vertices.begin(), vertices.end());
+      vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+      return vertices;
+    }
+
+    if (bits.size() < words) {
+      bits.resize(words);
+    }
+    std::fill_n(bits.begin(), words, 0);
+    for (const auto& edge : edges) {
+      const std::uint64_t offset = std::int64_t(vertex(edge)) - low;
+      bits[offset >> 6] |= std::uint64_t(1) << (offset & 63);
+    }
+    for (std::size_t i = 0; i != words; ++i) {
+      for (std::uint64_t word = bits[i]; word; word &= word - 1) {
+        vertices.push_back(low + int(i * 64 + std::countr_zero(word)));
+      }
+    }
+    return vertices;
+  }
+};
+
+// Print the Graphviz clusters for the vertices of the specified `layer`, and
+// the specified `edges` into it from the previous layer. `edges` is a range of
+// `BasicEdge`.
+template <typename Edges>
+void print_layer_graph(
+    int layer,
+    const Edges& edges,
+    DistinctVertices& vertices_scratch,
+    DotWriter& graphviz) {
+  if (layer == 1) {
+    // Edges go from layer n-1 to layer n. If this is layer 1, then we have to
+    // state the nodes for layer 0 first.
+    print_layer_subgraph(
+      0, vertices_scratch.of(edges, [](const auto& edge) { return edge.from; }), graphviz);
+  }
+
+  // Print the "to" vertices.
+  print_layer_subgraph(
+    layer, vertices_scratch.of(edges, [](const auto& edge) { return edge.to; }), graphviz);
+
+  // Print all of the edges.
+  graphviz <<
+    "\n";
+  const DotNodePrefix from_node{layer - 1};
+  const DotNodePrefix to_node{layer};
+  for (const auto& edge : edges) {
+    graphviz <<
+    "  " << from_node << edge.from << " -> " << to_node << edge.to << " [label=\"" << edge.weight << "\"]\n";
+  }
+}
+
+// Read the next layer of edges from `lines` into `destination`. If it's the
+// first `layer`, then first parse any graph header lines (see
+// `is_graph_header`) into `header`. If `graphviz` is not null, then also
+// print the layer to it. Return `false` if there are no more layers, or if a
+// header line is malformed, in which case `header.malformed` is set.
+template <typename Weight>
+bool read_layer(
+    LineReader& lines,
+    std::vector<BasicEdge<Weight>>& destination,
+    BasicGraphHeader<Weight>& header,
+    DotWriter *graphviz,
+    DistinctVertices& vertices_scratch,
+    int layer);
+
+template <typename Weight>
+struct BasicLayerGeneratorState {
+  std::vector<BasicEdge<Weight>> incoming;
+  BasicGraphHeader<Weight> header; // of the current graph
+  LineReader input;
+  DotWriter *graphviz; // null if we're not producing graph output
+  DistinctVertices vertices_scratch;
+  int layer;
+  // If not null, then set to `header.malformed` when the layers run out.
+  bool *malformed_header = nullptr;
+  // If `batch`, then `input` is a batch of graphs (see `is_graph_separator`),
+  // and a `BasicLayerIterator` covers only one graph of it. The same state is used
+  // for all of the graphs, so that its buffers are reused.
+  bool batch = false;
+  // whether to skip the rest of the current graph, because one of its layers
+  // is incomplete
+  bool skipping = false;
+  // whether the current graph has any lines, and whether one of them (a
+  // header line or a layer) couldn't be parsed
+  bool present = false;
+  bool malformed = false;
+  // whether `input` has no more lines
+  bool exhausted = false;
+};
+
+using LayerGeneratorState = BasicLayerGeneratorState<double>;
+
+// Read the next layer of the current graph of the batch in `state.input` into
+// `state.incoming`. Return `false` at the end of the graph, i.e. at the next
+// separator, at the end of the input, or at an incomplete layer. In the last
+// case, the rest of the graph is skipped.
+template <typename Weight>
+bool read_batch_layer(BasicLayerGeneratorState<Weight>& state);
+
+template <typename Weight>
+class BasicLayerIterator {
+  using Edges = std::vector<BasicEdge<Weight>>;
+
+  std::shared_ptr<BasicLayerGeneratorState<Weight>> state;
+
+public:
+  BasicLayerIterator()
+  : state(nullptr) {
+  }
+  // Read layers from `input`. If `graphviz` is not null, then also print each
+  // layer to it as it's read. If `malformed_header` is not null, then set it,
+  // when the layers run out, to whether they ran out because a header line of
+  // the graph is malformed (see `BasicGraphHeader::malformed`).
+  explicit BasicLayerIterator(std::istream& input, DotWriter *graphviz, bool *malformed_header = nullptr)
+  : state(new BasicLayerGeneratorState<Weight>{
+      .incoming = {},
+      .header = {},
+      .input = LineReader{input},
+      .graphviz = graphviz,
+      .vertices_scratch = {},
+      .layer = 0,
+      .malformed_header = malformed_header
+    }) {
+    // Get the initial layer.
+    ++(*this);
+  }
+  // Read the layers of the next graph of a batch using `state`, whose `batch`
+  // must be true. `state->exhausted` indicates when there are no more graphs.
+  explicit BasicLayerIterator(std::shared_ptr<BasicLayerGeneratorState<Weight>> state)
+  : state(std::move(state)) {
+    assert(this->state->batch);
+    this->state->header.clear();
+    this->state->present = false;
+    this->state->malformed = false;
+    this->state->layer = 0;
+    ++(*this);
+  }
+  BasicLayerIterator(const BasicLayerIterator&) = default;
+  BasicLayerIterator(BasicLayerIterator&&) = default;
+
+  BasicLayerIterator& operator++() {
+    ++state->layer;
+    const bool more = state->batch
+      ? read_batch_layer(*state)
+      : read_layer(
+          state->input,
+          state->incoming,
+          state->header,
+          state->graphviz,
+          state->vertices_scratch,
+          state->layer);
+    if (!more) {
+      if (state->malformed_header) {
+        *state->malformed_header = state->header.malformed;
+      }
+      state.reset();
+    }
+    return *this;
+  }
+
+  BasicLayerIterator operator++(int) {
+    BasicLayerIterator old = *this;
+    ++(*this);
+    return old;
+  }
+
+  // const std::vector<Edge>& operator*() const {
+  //   return state->incoming;
+  // }
+  std::pair<typename Edges::const_iterator, typename Edges::const_iterator>
+  operator*() const {
+    assert(state);
+    return std::make_pair(state->incoming.begin(), state->incoming.end());
+  }
+
+  // Return the header of the graph (see `is_graph_header`), which is known
+  // once the first layer has been read.
+  const BasicGraphHeader<Weight>& header() const {
+    assert(state);
+    return state->header;
+  }
+
+  // Return the offset in the input of the line after the current layer (see
+  // `LineReader::offset`), which is where the next layer begins.
+  std::uint64_t offset() const {
+    assert(state);
+    return state->input.offset();
+  }
+
+  bool operator==(const BasicLayerIterator& other) const {
+    return state == other.state;
+  }
+
+  bool operator!=(const BasicLayerIterator& other) const {
+    return state != other.state;
+  }
+};
+
+using LayerIterator = BasicLayerIterator<double>;
+
+// `LayerPipeline` reads layers on a producer thread, so that parsing the next
+// layers overlaps with relaxing the current one. Parsed layers go into a
+// bounded ring of edge buffers that are reused from one layer to the next.
+// The consumer `acquire`s the oldest parsed layer, and then `release`s it when
+// it's done, which lets the producer reuse its buffer.
+template <typename Weight>
+class BasicLayerPipeline {
+  std::mutex mutex;
+  std::condition_variable layer_ready;
+  // `slot_free` is a `condition_variable_any` so that the producer's wait can
+  // be interrupted by the `std::jthread` destructor.
+  std::condition_variable_any slot_free;
+  std::vector<std::vector<BasicEdge<Weight>>> slots;
+  // `slot_offsets[i]` is the offset in the input of the line after the layer
+  // in `slots[i]` (see `LineReader::offset`).
+  std::vector<std::uint64_t> slot_offsets;
+  // `slots[head]` is the oldest parsed layer, and `ready` is the number of
+  // parsed layers that have not been released yet, starting at `head`.
+  std::size_t head = 0;
+  std::size_t ready = 0;
+  bool finished = false; // whether the producer has read its last layer
+
+  // The producer parses `header` before the first layer, which it then makes
+  // ready, so the consumer can read `header` once it has acquired a layer.
+  BasicGraphHeader<Weight> graph_header;
+
+  // The following are used only by the producer.
+  LineReader input;
+  DotWriter *graphviz;
+  DistinctVertices vertices_scratch;
+
+  std::jthread producer;
+
+  void produce(std::stop_token);
+
+ public:
+  // Read layers from `input` into a ring of `depth` buffers. If `graphviz` is
+  // not null, then also print each layer to it as it's read.
+  BasicLayerPipeline(std::istream& input, DotWriter *graphviz, std::size_t depth);
+
+  // Wait for the next layer and return it, or return null if there are no
+  // more layers. The returned layer remains valid until `release` is called.
+  const std::vector<BasicEdge<Weight>> *acquire();
+
+  // Allow the producer to reuse the buffer of the layer most recently returned
+  // by `acquire`.
+  void release();
+
+  // Return the header of the graph (see `is_graph_header`). The behavior is
+  // undefined unless `acquire` has returned a layer, or has returned null.
+  const BasicGraphHeader<Weight>& header() const;
+
+  // Return the offset in the input of the line after the layer most recently
+  // returned by `acquire`. The behavior is undefined unless `acquire` has
+  // returned a layer that hasn't been released.
+  std::uint64_t offset() const;
+};
+
+using LayerPipeline = BasicLayerPipeline<double>;
+
+// `BasicPipelinedLayerIterator` is like `BasicLayerIterator`, except that it
+// reads layers ahead of time on another thread (see `BasicLayerPipeline`).
+template <typename Weight>
+class BasicPipelinedLayerIterator {
+  using Edges = std::vector<BasicEdge<Weight>>;
+
+  struct State {
+    BasicLayerPipeline<Weight> pipeline;
+    const Edges *current;
+    bool *malformed_header; // as in `BasicLayerGeneratorState`
+
+    State(std::istream& input, DotWriter *graphviz, std::size_t depth, bool *malformed_header)
+    : pipeline(input, graphviz, depth)
+    , current(nullptr)
+    , malformed_header(malformed_header) {
+    }
+  };
+
+  std::shared_ptr<State> state;
+
+  void acquire() {
+    state->current = state->pipeline.acquire();
+    if (!state->current) {
+      if (state->malformed_header) {
+        *state->malformed_header = state->pipeline.header().malformed;
+      }
+      state.reset();
+    }
+  }
+
+public:
+  BasicPipelinedLayerIterator()
+  : state(nullptr) {
+  }
+  // Read layers from `input`, buffering up to `depth` of them ahead of the
+  // consumer. If `graphviz` is not null, then also print each layer to it as
+  // it's read. `malformed_header` is as for `BasicLayerIterator`.
+  BasicPipelinedLayerIterator(
+      std::istream& input,
+      DotWriter *graphviz,
+      std::size_t depth,
+      bool *malformed_header = nullptr)
+  : state(std::make_shared<State>(input, graphviz, depth, malformed_header)) {
+    // Get the initial layer.
+    acquire();
+  }
+  BasicPipelinedLayerIterator(const BasicPipelinedLayerIterator&) = default;
+  BasicPipelinedLayerIterator(BasicPipelinedLayerIterator&&) = default;
+
+  BasicPipelinedLayerIterator& operator++() {
+    state->pipeline.release();
+    acquire();
+    return *this;
+  }
+
+  BasicPipelinedLayerIterator operator++(int) {
+    BasicPipelinedLayerIterator old = *this;
+    ++(*this);
+    return old;
+  }
+
+  std::pair<typename Edges::const_iterator, typename Edges::const_iterator>
+  operator*() const {
+    assert(state);
+    return std::make_pair(state->current->begin(), state->current->end());
+  }
+
+  // Return the header of the graph (see `is_graph_header`).
+  const BasicGraphHeader<Weight>& header() const {
+    assert(state);
+    return state->pipeline.header();
+  }
+
+  // Return the offset in the input of the line after the current layer, as
+  // `BasicLayerIterator::offset` does.
+  std::uint64_t offset() const {
+    assert(state);
+    return state->pipeline.offset();
+  }
+
+  bool operator==(const BasicPipelinedLayerIterator& other) const {
+    return state == other.state;
+  }
+
+  bool operator!=(const BasicPipelinedLayerIterator& other) const {
+    return state != other.state;
+  }
+};
+
+using PipelinedLayerIterator = BasicPipelinedLayerIterator<double>;
+
+// `LayerFileIterator<Record>` is like `LayerIterator`, except that it reads
+// layers out of a memory mapped layer file (see `layerfile.h`) whose records
+// are of type `Record`, some `BasicEdge`. The records are used in place.
+template <typename Record>
+class LayerFileIterator {
+  using Edges = std::span<const Record>;
+
+  struct State {
+    const MappedLayerFile& file;
+    Edges edges; // all of the edges in the file
+    DotWriter *graphviz; // null if we're not producing graph output
+    DistinctVertices vertices_scratch;
+    std::size_t layer; // zero-based index of the current layer
+  };
+
+  std::shared_ptr<State> state;
+
+  Edges current() const {
+    const auto [begin, end] = state->file.layer_bounds(state->layer);
+    return state->edges.subspan(begin, end - begin);
+  }
+
+  void arrive() {
+    if (state->layer == state->file.layer_count()) {
+      state.reset();
+    } else if (state->graphviz) {
+      print_layer_graph(state->layer + 1, current(), state->vertices_scratch, *state->graphviz);
+    }
+  }
+
+public:
+  LayerFileIterator()
+  : state(nullptr) {
+  }
+  // Read layers from `file`, which must outlive this object and its copies,
+  // beginning with the layer at the zero-based index `first_layer`, if the
+  // file has that many. If `graphviz` is not null, then also print each layer
+  // to it as it's read.
+  LayerFileIterator(const MappedLayerFile& file, DotWriter *graphviz, std::size_t first_layer = 0)
+  : state(new State{
+      .file = file,
+      .edges = file.all_records<Record>(),
+      .graphviz = graphviz,
+      .vertices_scratch = {},
+      .layer = std::min(first_layer, file.layer_count())
+    }) {
+    arrive();
+  }
+  LayerFileIterator(const LayerFileIterator&) = default;
+  LayerFileIterator(LayerFileIterator&&) = default;
+
+  LayerFileIterator& operator++() {
+    ++state->layer;
+    arrive();
+    return *this;
+  }
+
+  LayerFileIterator operator++(int) {
+    LayerFileIterator old = *this;
+    ++(*this);
+    return old;
+  }
+
+  std::pair<typename Edges::iterator, typename Edges::iterator>
+  operator*() const {
+    assert(state);
+    const auto edges = current();
+    return std::make_pair(edges.begin(), edges.end());
+  }
+
+  bool operator==(const LayerFileIterator& other) const {
+    return state == other.state;
+  }
+
+  bool operator!=(const LayerFileIterator& other) const {
+    return state != other.state;
+  }
+};
+
+// The text readers are instantiated in the library for these weight types.
+extern template bool read_layer(
+    LineReader&, std::vector<BasicEdge<double>>&, BasicGraphHeader<double>&, DotWriter*, DistinctVertices&, int);
+extern template bool read_layer(
+    LineReader&, std::vector<BasicEdge<float>>&, BasicGraphHeader<float>&, DotWriter*, DistinctVertices&, int);
+extern template bool read_layer(
+    LineReader&, std::vector<BasicEdge<std::int32_t>>&, BasicGraphHeader<std::int32_t>&, DotWriter*, DistinctVertices&, int);
+extern template bool read_batch_layer(BasicLayerGeneratorState<double>&);
+extern template bool read_batch_layer(BasicLayerGeneratorState<float>&);
+extern template bool read_batch_layer(BasicLayerGeneratorState<std::int32_t>&);
+extern template class BasicLayerPipeline<double>;
+extern template class BasicLayerPipeline<float>;
+extern template class BasicLayerPipeline<std::int32_t>;
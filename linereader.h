@@ -0,0 +1,156 @@
+// `LineReader` splits the contents of a `std::istream` into lines without
+// copying them. It reads the stream in large chunks into a buffer that it
+// reuses, and hands out each line as a `std::string_view` into that buffer.
+//
+// Lines are separated by '\n', just like `std::getline`. The last line need
+// not end with a newline, and an input that ends with a newline does not have
+// an empty line at the end.
+//
+// `parse_field` is the other half of a parser: it skips whitespace and then
+// converts the next field in a line using `std::from_chars`, which (unlike
+// `operator>>`) knows nothing of locales or stream state.
+//
+// For example:
+//
+//     LineReader reader{std::cin};
+//     std::string_view line;
+//     while (reader.next_line(line)) {
+//       const char *cursor = line.data();
+//       const char *const end = cursor + line.size();
+//       int number;
+//       while (parse_field(cursor, end, number)) {
+//         std::cout << number << '\n';
+//       }
+//     }
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <streambuf>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+class LineReader {
+  std::streambuf *input;
+  std::vector<char> buffer;
+  // `[begin, end)` is the part of `buffer` that has been read but not yet
+  // returned as a line. `[begin, scanned)` is known not to contain a newline.
+  std::size_t begin = 0;
+  std::size_t scanned = 0;
+  std::size_t end = 0;
+  // the number of bytes of input that were moved out of the front of
+  // `buffer`, i.e. that precede `buffer[0]`
+  std::uint64_t discarded = 0;
+  bool exhausted = false;
+
+ public:
+  explicit LineReader(std::istream& input, std::size_t buffer_size = 1 << 20);
+
+  // Assign the next line (excluding its newline) to `line` and return `true`,
+  // or return `false` if there are no more lines. `line` refers to memory in
+  // this object and remains valid until the next call to `next_line`.
+  bool next_line(std::string_view& line);
+
+  // Return the number of bytes of input taken up by the lines returned so
+  // far, including their newlines, i.e. the offset in the input of the next
+  // line.
+  std::uint64_t offset() const;
+};
+
+// Return whether the specified `character` is whitespace as considered by
+// `operator>>` in the "C" locale.
+inline bool is_space(char character) {
+  return character == ' ' || (character >= '\t' && character <= '\r');
+}
+
+// Advance `cursor` past any whitespace before `end`, and then parse a number
+// out of `[cursor, end)` into `value`. Return `true` and advance `cursor` past
+// the number on success. Return `false` if the field is missing, malformed, or
+// out of range, in which case `value` is unspecified.
+//
+// As with `operator>>`, an explicit leading '+' is allowed. Unlike
+// `std::from_chars`, "inf", "nan", and friends are not.
+template <typename Number>
+bool parse_field(const char *&cursor, const char *end, Number& value) {
+  const char *first = cursor;
+  while (first != end && is_space(*first)) {
+    ++first;
+  }
+  const char *digits = first;
+  if (digits != end && (*digits == '+' || *digits == '-')) {
+    ++digits;
+  }
+  if (digits == end || !((*digits >= '0' && *digits <= '9') || *digits == '.')) {
+    return false;
+  }
+  if (*first == '+') {
+    ++first;
+  }
+  const auto [after, error] = std::from_chars(first, end, value);
+  if (error != std::errc{}) {
+    return false;
+  }
+  cursor = after;
+  return true;
+}
+
+// Implementation
+// ==============
+
+// class LineReader
+// ----------------
+inline LineReader::LineReader(std::istream& input, std::size_t buffer_size)
+: input(input.rdbuf())
+, buffer(buffer_size) {
+}
+
+inline bool LineReader::next_line(std::string_view& line) {
+  for (;;) {
+    char *const data = buffer.data();
+    if (const void *newline = std::memchr(data + scanned, '\n', end - scanned)) {
+      const char *const line_end = static_cast<const char*>(newline);
+      line = std::string_view(data + begin, line_end - (data + begin));
+      begin = scanned = line_end + 1 - data;
+      return true;
+    }
+    scanned = end;
+
+    if (exhausted) {
+      if (begin == end) {
+        return false;
+      }
+      line = std::string_view(data + begin, end - begin);
+      begin = scanned = end;
+      return true;
+    }
+
+    // We need more input. Move the partial line to the front of the buffer,
+    // growing the buffer if the partial line already fills it.
+    if (begin != 0) {
+      std::memmove(data, data + begin, end - begin);
+      discarded += begin;
+      end -= begin;
+      scanned -= begin;
+      begin = 0;
+    }
+    if (end == buffer.size()) {
+      buffer.resize(buffer.size() * 2);
+    }
+    const std::streamsize count =
+      input ? input->sgetn(buffer.data() + end, buffer.size() - end) : 0;
+    if (count <= 0) {
+      exhausted = true;
+    } else {
+      end += count;
+    }
+  }
+}
+
+inline std::uint64_t LineReader::offset() const {
+  return discarded + begin;
+}
@@ -19,26 +19,172 @@
 //        x = List(); // This will destroy nothing.
 //        y = List(); // This will destroy 7, 6, and 5.
 //      } // This will destroy 9, 8, 4, 3, 2, and 1.
+//
+// The one exception to immutability is `detach_tail`, which cuts a list short
+// in place. It's meant for discarding a prefix of history that every list
+// of interest shares.
+//
+// Nodes are allocated using `Allocator`, which is rebound to the node type.
+// `Allocator` must be stateless and default constructible, since a
+// `LispyList` is nothing but a pointer to its first node. For example,
+// `LispyList<int, PoolAllocator<int>>` (see `nodepool.h`) recycles the nodes
+// of destroyed lists instead of returning them to the system allocator.
+//
+// Destroying the last list that refers to a long chain of nodes frees the
+// whole chain at once, which can take a while. To avoid that, a thread can
+// `defer_reclamation`: then nodes whose refcount reaches zero are set aside
+// instead, and freed later by calls to `reclaim`, which frees at most a
+// specified number of nodes per call. Lists are released and reclaimed on the
+// same thread as far as deferral is concerned, so nodes set aside on a thread
+// are freed only by that thread.
+//
+// How nodes are refcounted is up to the `Refcount` policy. The default,
+// `PlainRefcount`, is a plain `int`, so lists that share nodes must all be
+// used on one thread. `AtomicRefcount` lets them be used on different threads
+// (see `AtomicRefcount` for the fine print).
+//
+// `prepend` on an rvalue list, e.g. `std::move(list).prepend(value)` or
+// `list.tail().prepend(value)`, hands the list's reference to its first node
+// over to the new node, rather than taking a new reference and then dropping
+// the old one with the list.
+//
+// If `LISPYLIST_STATS` is defined, then node allocations and frees are
+// counted per thread in `LispyListStats`. Otherwise, the counting compiles to
+// nothing.
 
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
 #include <utility>
+#include <vector>
+
+#ifdef LISPYLIST_STATS
+#define LISPYLIST_STAT(statement) statement
+#else
+#define LISPYLIST_STAT(statement)
+#endif
+
+// `LispyListStats` counts the nodes allocated and freed by the `LispyList`s
+// of the current thread, of all value types. It's updated only if
+// `LISPYLIST_STATS` is defined.
+struct LispyListStats {
+  std::uint64_t allocations = 0;
+  std::uint64_t frees = 0;
+  std::uint64_t live = 0; // `allocations - frees`
+  std::uint64_t peak_live = 0;
+  // A cascade is the run of nodes freed by destroying one list. A list that
+  // was the only one referring to a long path frees the whole path at once.
+  // `cascade_histogram[i]` counts cascades of length `[2^(i-1), 2^i)`.
+  std::uint64_t cascades = 0;
+  std::uint64_t longest_cascade = 0; // may be reset by whoever reports it
+  std::uint64_t cascade_histogram[65] = {};
+
+  static LispyListStats& instance() {
+    thread_local LispyListStats stats;
+    return stats;
+  }
+
+  void allocated() {
+    ++allocations;
+    peak_live = std::max(peak_live, ++live);
+  }
+
+  void freed(std::uint64_t count) {
+    if (count == 0) {
+      return;
+    }
+    frees += count;
+    live -= count;
+    ++cascades;
+    longest_cascade = std::max(longest_cascade, count);
+    ++cascade_histogram[std::bit_width(count)];
+  }
+};
+
+// `PlainRefcount` is the `Refcount` policy of a `LispyList` whose nodes are
+// used on one thread: the refcounts are plain integers.
+struct PlainRefcount {
+  using count_type = int;
+
+  // Add a reference to `count`.
+  static void acquire(int& count) {
+    ++count;
+  }
+
+  // Drop a reference from `count`, and return whether it was the last.
+  static bool release(int& count) {
+    return --count == 0;
+  }
+};
 
-template <typename Value>
+// `AtomicRefcount` is the `Refcount` policy of a `LispyList` whose nodes are
+// shared by lists on different threads, e.g. paths handed over to a consumer
+// thread. A reference is added without ordering, since whoever adds it holds
+// a reference already, but it's dropped with acquire-release ordering, so
+// that the thread that frees a node sees everything that other threads did
+// with it. Updates cost more than `PlainRefcount`'s, even without contention.
+//
+// A node is freed on the thread that drops its last reference, so the
+// allocator must be able to free memory allocated on another thread, as
+// `std::allocator` can but `PoolAllocator` can't. Nodes set aside by
+// `defer_reclamation` are likewise set aside on the thread that released
+// them. The list objects themselves are no more thread safe than an `int`,
+// and neither is `detach_tail`.
+struct AtomicRefcount {
+  using count_type = std::atomic<int>;
+
+  static void acquire(std::atomic<int>& count) {
+    count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static bool release(std::atomic<int>& count) {
+    return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+};
+
+template <typename Value, typename Allocator = std::allocator<Value>, typename Refcount = PlainRefcount>
 class LispyList;
-template <typename Value>
+template <typename Value, typename Refcount = PlainRefcount>
 class LispyListIterator;
-template <typename Value>
+template <typename Value, typename Refcount = PlainRefcount>
 class LispyListNode;
 
-template <typename Value>
+template <typename Value, typename Allocator, typename Refcount>
 class LispyList {
-  LispyListNode<Value> *node;
-  explicit LispyList(LispyListNode<Value>*);
+  using Node = LispyListNode<Value, Refcount>;
+  using NodeAllocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+  using NodeTraits = std::allocator_traits<NodeAllocator>;
+
+  Node *node;
+  explicit LispyList(Node*);
   void cleanup();
 
+  // Nodes whose refcount has reached zero, but which haven't been freed yet.
+  struct Reclaimer {
+    bool deferred = false;
+    std::vector<Node*> pending;
+  };
+  static Reclaimer& reclaimer();
+
+  // Free `dead`, whose refcount has reached zero, and then each following
+  // node whose refcount thereby reaches zero, but free at most `budget`
+  // nodes, and deduct the number freed from `budget`. Return the first node
+  // that was due to be freed but wasn't, or null if there's none.
+  static Node *release(Node *dead, std::size_t& budget);
+
  public:
+  using value_type = Value;
+
   LispyList();
   LispyList(const LispyList&);
   LispyList(LispyList&&);
@@ -52,20 +198,44 @@ class LispyList {
   LispyList tail() const;
   bool empty() const;
 
-  LispyList prepend(Value value) const;
+  // Return the list of `value` followed by the elements of this list. The
+  // rvalue overload moves this list's reference to its first node into the
+  // new node, and leaves this list empty.
+  LispyList prepend(Value value) const&;
+  LispyList prepend(Value value) &&;
+
+  // Detach and return the tail of this list, so that this list's first node
+  // becomes the last node of every list that contains it. The behavior is
+  // undefined if this list is empty.
+  LispyList detach_tail();
 
-  LispyListIterator<Value> begin() const;
-  LispyListIterator<Value> end() const;
+  LispyListIterator<Value, Refcount> begin() const;
+  LispyListIterator<Value, Refcount> end() const;
+
+  // Set whether nodes released on the calling thread are set aside for
+  // `reclaim` rather than freed immediately. Turning deferral off frees all
+  // of the nodes that were set aside.
+  static void defer_reclamation(bool defer);
+  static bool reclamation_deferred();
+
+  // Free at most `budget` of the nodes set aside on the calling thread.
+  // Return the number freed.
+  static std::size_t reclaim(std::size_t budget);
+
+  // Return whether any nodes set aside on the calling thread remain to be
+  // freed.
+  static bool reclamation_pending();
 
   bool operator==(const LispyList& other) const;
   bool operator!=(const LispyList& other) const;
 };
 
-template <typename Value>
+template <typename Value, typename Refcount>
 class LispyListIterator {
-  LispyListNode<Value> *node;
-  explicit LispyListIterator(LispyListNode<Value>*);
-  friend class LispyList<Value>;
+  LispyListNode<Value, Refcount> *node;
+  explicit LispyListIterator(LispyListNode<Value, Refcount>*);
+  template <typename, typename, typename>
+  friend class LispyList;
 public:
   LispyListIterator();
   LispyListIterator(const LispyListIterator&) = default;
@@ -76,14 +246,18 @@ public:
   LispyListIterator& operator++();
   LispyListIterator operator++(int) const;
 
+  // Return a number that identifies the node that this iterator is at, and
+  // that's the same for every list containing the node, or zero at the end.
+  std::uintptr_t id() const;
+
   bool operator==(LispyListIterator) const;
   bool operator!=(LispyListIterator) const;
 };
 
 namespace std {
 
-template <typename Value>
-struct iterator_traits<LispyListIterator<Value>> {
+template <typename Value, typename Refcount>
+struct iterator_traits<LispyListIterator<Value, Refcount>> {
   using value_type = const Value;
   using pointer = const Value*;
   using reference = const Value&;
@@ -93,72 +267,100 @@ struct iterator_traits<LispyListIterator<Value>> {
 
 } // namespace std
 
-template <typename Value>
+template <typename Value, typename Refcount>
 struct LispyListNode {
   const Value value;
-  int refcount;
-  LispyListNode *const next;
+  typename Refcount::count_type refcount;
+  LispyListNode *next;
 };
 
 // Implementation
 // ==============
 
-// class LispyList<Value>
-// ----------------------
-template <typename Value>
-void LispyList<Value>::cleanup() {
-  LispyListNode<Value> *current = node;
-  while (current && --current->refcount == 0) {
-    auto *old = current;
-    current = current->next;
-    delete old;
+// class LispyList<Value, Allocator, Refcount>
+// -------------------------------------------
+template <typename Value, typename Allocator, typename Refcount>
+void LispyList<Value, Allocator, Refcount>::cleanup() {
+  if (!node || !Refcount::release(node->refcount)) {
+    return;
   }
+  Reclaimer& deferred = reclaimer();
+  if (deferred.deferred) {
+    deferred.pending.push_back(node);
+    return;
+  }
+  std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+  release(node, unlimited);
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+typename LispyList<Value, Allocator, Refcount>::Reclaimer& LispyList<Value, Allocator, Refcount>::reclaimer() {
+  thread_local Reclaimer instance;
+  return instance;
 }
 
-template <typename Value>
-LispyList<Value>::LispyList(LispyListNode<Value> *node)
+template <typename Value, typename Allocator, typename Refcount>
+typename LispyList<Value, Allocator, Refcount>::Node *LispyList<Value, Allocator, Refcount>::release(
+    Node *dead,
+    std::size_t& budget) {
+  NodeAllocator allocator;
+  LISPYLIST_STAT(std::uint64_t freed = 0);
+  while (dead && budget) {
+    Node *const next = dead->next;
+    NodeTraits::destroy(allocator, dead);
+    NodeTraits::deallocate(allocator, dead, 1);
+    --budget;
+    LISPYLIST_STAT(++freed);
+    dead = next && Refcount::release(next->refcount) ? next : nullptr;
+  }
+  LISPYLIST_STAT(LispyListStats::instance().freed(freed));
+  return dead;
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>::LispyList(Node *node)
 : node(node) {
 }
 
-template <typename Value>
-LispyList<Value>::LispyList()
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>::LispyList()
 : node(nullptr) {}
 
 
-template <typename Value>
-LispyList<Value>::LispyList(const LispyList<Value>& other)
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>::LispyList(const LispyList<Value, Allocator, Refcount>& other)
 : node(other.node) {
   if (node) {
-    ++node->refcount;
+    Refcount::acquire(node->refcount);
   }
 }
 
-template <typename Value>
-LispyList<Value>::LispyList(LispyList<Value>&& other)
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>::LispyList(LispyList<Value, Allocator, Refcount>&& other)
 : node(other.node) {
   other.node = nullptr;
 }
 
-template <typename Value>
-LispyList<Value>::~LispyList() {
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>::~LispyList() {
   cleanup();
 }
 
-template <typename Value>
-LispyList<Value>& LispyList<Value>::operator=(const LispyList<Value>& other) {
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>& LispyList<Value, Allocator, Refcount>::operator=(const LispyList<Value, Allocator, Refcount>& other) {
   if (&other == this) {
     return *this;
   }
   cleanup();
   node = other.node;
   if (node) {
-    ++node->refcount;
+    Refcount::acquire(node->refcount);
   }
   return *this;
 }
 
-template <typename Value>
-LispyList<Value>& LispyList<Value>::operator=(LispyList<Value>&& other) {
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount>& LispyList<Value, Allocator, Refcount>::operator=(LispyList<Value, Allocator, Refcount>&& other) {
   if (&other == this) {
     return *this;
   }
@@ -168,100 +370,162 @@ LispyList<Value>& LispyList<Value>::operator=(LispyList<Value>&& other) {
   return *this;
 }
 
-template <typename Value>
-const Value& LispyList<Value>::head() const {
+template <typename Value, typename Allocator, typename Refcount>
+const Value& LispyList<Value, Allocator, Refcount>::head() const {
   assert(node);
   return node->value;
 }
 
-template <typename Value>
-LispyList<Value> LispyList<Value>::tail() const {
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount> LispyList<Value, Allocator, Refcount>::tail() const {
   assert(node);
   if (node->next) {
-    ++node->next->refcount;
+    Refcount::acquire(node->next->refcount);
   }
-  return LispyList<Value>(node->next);
+  return LispyList<Value, Allocator, Refcount>(node->next);
 }
 
-template <typename Value>
-bool LispyList<Value>::empty() const {
+template <typename Value, typename Allocator, typename Refcount>
+bool LispyList<Value, Allocator, Refcount>::empty() const {
   return node == nullptr;
 }
 
-template <typename Value>
-LispyList<Value> LispyList<Value>::prepend(Value value) const {
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount> LispyList<Value, Allocator, Refcount>::prepend(Value value) const& {
   if (node) {
-    ++node->refcount;
+    Refcount::acquire(node->refcount);
   }
 
-  return LispyList<Value>(new LispyListNode<Value>{
+  NodeAllocator allocator;
+  LISPYLIST_STAT(LispyListStats::instance().allocated());
+  return LispyList<Value, Allocator, Refcount>(new (NodeTraits::allocate(allocator, 1)) Node{
     .value = std::move(value),
     .refcount = 1,
     .next = node
   });
 }
 
-template <typename Value>
-LispyListIterator<Value> LispyList<Value>::begin() const {
-  return LispyListIterator<Value>(node);
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount> LispyList<Value, Allocator, Refcount>::prepend(Value value) && {
+  NodeAllocator allocator;
+  Node *const first = NodeTraits::allocate(allocator, 1);
+  LISPYLIST_STAT(LispyListStats::instance().allocated());
+  // The reference that this list held to `node` now belongs to `first`.
+  new (first) Node{
+    .value = std::move(value),
+    .refcount = 1,
+    .next = std::exchange(node, nullptr)
+  };
+  return LispyList<Value, Allocator, Refcount>(first);
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+LispyList<Value, Allocator, Refcount> LispyList<Value, Allocator, Refcount>::detach_tail() {
+  assert(node);
+  // The reference that `node` held to its tail now belongs to the result.
+  Node *const tail = node->next;
+  node->next = nullptr;
+  return LispyList<Value, Allocator, Refcount>(tail);
 }
 
-template <typename Value>
-LispyListIterator<Value> LispyList<Value>::end() const {
-  return LispyListIterator<Value>();
+template <typename Value, typename Allocator, typename Refcount>
+LispyListIterator<Value, Refcount> LispyList<Value, Allocator, Refcount>::begin() const {
+  return LispyListIterator<Value, Refcount>(node);
 }
 
-template <typename Value>
-bool LispyList<Value>::operator==(const LispyList<Value>& other) const {
+template <typename Value, typename Allocator, typename Refcount>
+LispyListIterator<Value, Refcount> LispyList<Value, Allocator, Refcount>::end() const {
+  return LispyListIterator<Value, Refcount>();
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+void LispyList<Value, Allocator, Refcount>::defer_reclamation(bool defer) {
+  reclaimer().deferred = defer;
+  if (!defer) {
+    reclaim(std::numeric_limits<std::size_t>::max());
+  }
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+bool LispyList<Value, Allocator, Refcount>::reclamation_deferred() {
+  return reclaimer().deferred;
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+std::size_t LispyList<Value, Allocator, Refcount>::reclaim(std::size_t budget) {
+  std::vector<Node*>& pending = reclaimer().pending;
+  const std::size_t initial_budget = budget;
+  while (budget && !pending.empty()) {
+    if (Node *const rest = release(pending.back(), budget)) {
+      pending.back() = rest;
+    } else {
+      pending.pop_back();
+    }
+  }
+  return initial_budget - budget;
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+bool LispyList<Value, Allocator, Refcount>::reclamation_pending() {
+  return !reclaimer().pending.empty();
+}
+
+template <typename Value, typename Allocator, typename Refcount>
+bool LispyList<Value, Allocator, Refcount>::operator==(const LispyList<Value, Allocator, Refcount>& other) const {
   return node == other.node;
 }
 
-template <typename Value>
-bool LispyList<Value>::operator!=(const LispyList<Value>& other) const {
+template <typename Value, typename Allocator, typename Refcount>
+bool LispyList<Value, Allocator, Refcount>::operator!=(const LispyList<Value, Allocator, Refcount>& other) const {
   return node != other.node;
 }
 
-// class LispyListIterator<Value>
-// ------------------------------
-template <typename Value>
-LispyListIterator<Value>::LispyListIterator(LispyListNode<Value> *node)
+// class LispyListIterator<Value, Refcount>
+// ----------------------------------------
+template <typename Value, typename Refcount>
+LispyListIterator<Value, Refcount>::LispyListIterator(LispyListNode<Value, Refcount> *node)
 : node(node) {}
 
-template <typename Value>
-LispyListIterator<Value>::LispyListIterator()
+template <typename Value, typename Refcount>
+LispyListIterator<Value, Refcount>::LispyListIterator()
 : node(nullptr) {}
 
-template <typename Value>
-const Value& LispyListIterator<Value>::operator*() const {
+template <typename Value, typename Refcount>
+const Value& LispyListIterator<Value, Refcount>::operator*() const {
   assert(node);
   return node->value;
 }
 
-template <typename Value>
-const Value *LispyListIterator<Value>::operator->() const {
+template <typename Value, typename Refcount>
+const Value *LispyListIterator<Value, Refcount>::operator->() const {
   return &**this;
 }
 
-template <typename Value>
-LispyListIterator<Value>& LispyListIterator<Value>::operator++() {
+template <typename Value, typename Refcount>
+LispyListIterator<Value, Refcount>& LispyListIterator<Value, Refcount>::operator++() {
   if (node) {
     node = node->next;
   }
   return *this;
 }
 
-template <typename Value>
-LispyListIterator<Value> LispyListIterator<Value>::operator++(int) const {
+template <typename Value, typename Refcount>
+LispyListIterator<Value, Refcount> LispyListIterator<Value, Refcount>::operator++(int) const {
   auto copy = *this;
   return ++copy;
 }
 
-template <typename Value>
-bool LispyListIterator<Value>::operator==(LispyListIterator<Value> other) const {
+template <typename Value, typename Refcount>
+std::uintptr_t LispyListIterator<Value, Refcount>::id() const {
+  return reinterpret_cast<std::uintptr_t>(node);
+}
+
+template <typename Value, typename Refcount>
+bool LispyListIterator<Value, Refcount>::operator==(LispyListIterator<Value, Refcount> other) const {
   return node == other.node;
 }
 
-template <typename Value>
-bool LispyListIterator<Value>::operator!=(LispyListIterator<Value> other) const {
+template <typename Value, typename Refcount>
+bool LispyListIterator<Value, Refcount>::operator!=(LispyListIterator<Value, Refcount> other) const {
   return node != other.node;
 }
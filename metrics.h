@@ -0,0 +1,168 @@
+// `LayerMetrics` collects per-layer timings and counts from a solve: how long
+// each layer took to read and to relax, how many edges it had, how many of
+// them improved on the best path found so far to their `to` vertex, and how
+// many path nodes were allocated for it. Each quantity goes into a
+// `Histogram` of fixed buckets, so that recording a layer costs a few
+// instructions and no allocation, however many layers there are, and a
+// summary of percentiles can be printed at any time.
+//
+// If `SHORTESTPATH_METRICS` is defined, then `CheapestPathsSolver` records its
+// layers into `SolveOptions::metrics`, if it's set. Otherwise, the recording
+// compiles to nothing.
+//
+// Times are measured in ticks of `metrics_ticks`, which is the time stamp
+// counter on x86, since reading it takes a few nanoseconds, where reading
+// `std::chrono::steady_clock` can take tens, which would be too much for a
+// layer that takes a microsecond to relax. Ticks are converted to time when
+// they're printed, at the rate observed since the `LayerMetrics` was made.
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#if __has_include(<x86intrin.h>)
+#include <x86intrin.h>
+#define SHORTESTPATH_METRICS_TSC
+#endif
+
+#ifdef SHORTESTPATH_METRICS
+#define LAYER_METRIC(statement) statement
+#else
+#define LAYER_METRIC(statement)
+#endif
+
+// Return the current time, in ticks of some clock that's cheap to read.
+inline std::uint64_t metrics_ticks() {
+#ifdef SHORTESTPATH_METRICS_TSC
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// `Histogram` counts values in buckets that are the same width within each
+// power of two, with eight buckets per power of two, so that a percentile is
+// accurate to within an eighth. Values less than eight have buckets of their
+// own.
+class Histogram {
+  static constexpr int sub_buckets = 8;
+  static constexpr int bucket_count = (64 - 2) * sub_buckets;
+
+  std::array<std::uint64_t, bucket_count> counts{};
+  std::uint64_t total = 0; // the number of values
+  std::uint64_t greatest = 0;
+
+  static int bucket(std::uint64_t value) {
+    if (value < sub_buckets) {
+      return int(value);
+    }
+    const int exponent = std::bit_width(value) - 1; // at least 3
+    return (exponent - 2) * sub_buckets + int(value >> (exponent - 3)) - sub_buckets;
+  }
+
+  // Return the greatest value that falls in `bucket`.
+  static std::uint64_t bucket_limit(int bucket) {
+    if (bucket < sub_buckets) {
+      return bucket;
+    }
+    const int exponent = bucket / sub_buckets + 2;
+    const std::uint64_t first = std::uint64_t(sub_buckets + bucket % sub_buckets) << (exponent - 3);
+    return first + (std::uint64_t(1) << (exponent - 3)) - 1;
+  }
+
+ public:
+  void record(std::uint64_t value) {
+    ++counts[bucket(value)];
+    ++total;
+    greatest = value > greatest ? value : greatest;
+  }
+
+  // Return the number of values recorded.
+  std::uint64_t count() const {
+    return total;
+  }
+
+  // Return the greatest value recorded, or zero if there are none.
+  std::uint64_t max() const {
+    return greatest;
+  }
+
+  // Return a value that's at least the `fraction` quantile of the values
+  // recorded, e.g. `percentile(0.99)` is the 99th percentile, but no more
+  // than an eighth more than it, and no more than `max()`.
+  std::uint64_t percentile(double fraction) const {
+    const std::uint64_t rank = std::uint64_t(fraction * double(total - 1));
+    std::uint64_t seen = 0;
+    for (int bucket = 0; bucket != bucket_count; ++bucket) {
+      seen += counts[bucket];
+      if (seen > rank) {
+        const std::uint64_t limit = bucket_limit(bucket);
+        return limit < greatest ? limit : greatest;
+      }
+    }
+    return greatest;
+  }
+};
+
+struct LayerMetrics {
+  // ticks spent waiting for each layer to be read, and then for the read that
+  // finds the end of the input, so there's one more of these than of the rest
+  Histogram read;
+  Histogram relax; // ticks spent in `push_layer`, extending the paths too
+  Histogram edges;
+  // One per layer relaxed by the general loop, which is all of them except
+  // dense layers (see `DenseOrder`) and layers relaxed on multiple threads,
+  // whose kernels don't branch on improvements.
+  Histogram improved_edges;
+  Histogram allocated_nodes;
+
+  // for converting ticks to time
+  std::uint64_t start_ticks = metrics_ticks();
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+  // Print a summary of each histogram to `output`: its 50th and 99th
+  // percentiles and its maximum. Times are in microseconds.
+  void print(std::ostream& output) const;
+};
+
+// Implementation
+// ==============
+
+// struct LayerMetrics
+// -------------------
+inline void LayerMetrics::print(std::ostream& output) const {
+  const double elapsed_us = std::chrono::duration<double, std::micro>(
+    std::chrono::steady_clock::now() - start_time).count();
+  const std::uint64_t elapsed_ticks = metrics_ticks() - start_ticks;
+  const double us_per_tick = elapsed_ticks ? elapsed_us / double(elapsed_ticks) : 0;
+
+  const std::streamsize precision = output.precision(3);
+  output << "Metrics over " << relax.count() << " layers:\n";
+  const auto line = [&](const char *name, const Histogram& histogram, double scale) {
+    output << "  " << std::left << std::setw(22) << name << std::right;
+    if (histogram.count() == 0) {
+      output << "none recorded\n";
+      return;
+    }
+    output
+      << "p50 " << std::setw(10) << double(histogram.percentile(0.5)) * scale
+      << "  p99 " << std::setw(10) << double(histogram.percentile(0.99)) * scale
+      << "  max " << std::setw(10) << double(histogram.max()) * scale;
+    if (histogram.count() != relax.count()) {
+      output << "  (" << histogram.count() << " layers)";
+    }
+    output << '\n';
+  };
+  line("read (us)", read, us_per_tick);
+  line("relax (us)", relax, us_per_tick);
+  line("edges", edges, 1);
+  line("improved edges", improved_edges, 1);
+  line("allocated nodes", allocated_nodes, 1);
+  output.precision(precision);
+}
@@ -0,0 +1,156 @@
+// `PoolAllocator<T>` is a stateless allocator that serves single-object
+// allocations out of a per-thread `NodePool`, rather than calling
+// `operator new` and `operator delete` for every object.
+//
+// It's intended for node-based data structures, like `LispyList`, that
+// allocate and free lots of small objects of the same size, e.g.
+//
+//     using List = LispyList<int, PoolAllocator<int>>;
+//
+// Each distinct object size (and alignment) gets its own pool -- its own
+// "size class." A pool carves blocks out of large slabs of memory, and freed
+// blocks go onto a free list to be handed out again by later allocations.
+// Slabs are never returned to the system until the thread that owns the pool
+// exits.
+//
+// The pool is `thread_local`, so there's no synchronization. The catch is that
+// an object must be deallocated by the same thread that allocated it.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+template <std::size_t Size, std::size_t Alignment>
+class NodePool {
+  union Block {
+    Block *next; // when on the free list
+    alignas(Alignment) unsigned char storage[Size]; // when allocated
+  };
+
+  // Slabs start small so that short runs don't pay for memory they won't use,
+  // and then grow geometrically up to a limit.
+  static constexpr std::size_t min_slab_blocks = 256;
+  static constexpr std::size_t max_slab_blocks = 65536;
+
+  std::vector<std::unique_ptr<Block[]>> slabs;
+  // `[bump, bump_end)` is the part of the most recent slab that has never been
+  // allocated.
+  Block *bump = nullptr;
+  Block *bump_end = nullptr;
+  Block *free_list = nullptr;
+  std::size_t live_blocks = 0;
+  std::size_t total_blocks = 0;
+
+  NodePool() = default;
+
+ public:
+  NodePool(const NodePool&) = delete;
+  NodePool& operator=(const NodePool&) = delete;
+
+  static NodePool& instance();
+
+  void *allocate();
+  void deallocate(void*);
+
+  // Return the number of blocks currently allocated.
+  std::size_t live() const;
+  // Return the number of blocks in all slabs, allocated or not.
+  std::size_t capacity() const;
+};
+
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename Other>
+  PoolAllocator(const PoolAllocator<Other>&) {}
+
+  T *allocate(std::size_t count);
+  void deallocate(T *pointer, std::size_t count);
+
+  template <typename Other>
+  bool operator==(const PoolAllocator<Other>&) const { return true; }
+  template <typename Other>
+  bool operator!=(const PoolAllocator<Other>&) const { return false; }
+
+  // Return the `NodePool` used for single objects of type `T`.
+  static NodePool<sizeof(T), alignof(T)>& pool();
+};
+
+// Implementation
+// ==============
+
+// class NodePool<Size, Alignment>
+// -------------------------------
+template <std::size_t Size, std::size_t Alignment>
+NodePool<Size, Alignment>& NodePool<Size, Alignment>::instance() {
+  thread_local NodePool pool;
+  return pool;
+}
+
+template <std::size_t Size, std::size_t Alignment>
+void *NodePool<Size, Alignment>::allocate() {
+  ++live_blocks;
+  if (free_list) {
+    Block *block = free_list;
+    free_list = block->next;
+    return block;
+  }
+  if (bump == bump_end) {
+    const std::size_t count = std::min(
+      max_slab_blocks, std::max(min_slab_blocks, total_blocks));
+    slabs.emplace_back(new Block[count]);
+    bump = slabs.back().get();
+    bump_end = bump + count;
+    total_blocks += count;
+  }
+  return bump++;
+}
+
+template <std::size_t Size, std::size_t Alignment>
+void NodePool<Size, Alignment>::deallocate(void *pointer) {
+  --live_blocks;
+  Block *block = static_cast<Block*>(pointer);
+  block->next = free_list;
+  free_list = block;
+}
+
+template <std::size_t Size, std::size_t Alignment>
+std::size_t NodePool<Size, Alignment>::live() const {
+  return live_blocks;
+}
+
+template <std::size_t Size, std::size_t Alignment>
+std::size_t NodePool<Size, Alignment>::capacity() const {
+  return total_blocks;
+}
+
+// class PoolAllocator<T>
+// ----------------------
+template <typename T>
+NodePool<sizeof(T), alignof(T)>& PoolAllocator<T>::pool() {
+  return NodePool<sizeof(T), alignof(T)>::instance();
+}
+
+template <typename T>
+T *PoolAllocator<T>::allocate(std::size_t count) {
+  if (count == 1) {
+    return static_cast<T*>(pool().allocate());
+  }
+  return std::allocator<T>().allocate(count);
+}
+
+template <typename T>
+void PoolAllocator<T>::deallocate(T *pointer, std::size_t count) {
+  if (count == 1) {
+    pool().deallocate(pointer);
+    return;
+  }
+  std::allocator<T>().deallocate(pointer, count);
+}
@@ -0,0 +1,539 @@
+// A path through a layered graph (see `layer.h`) is a list of `VertexState`s,
+// one per layer, from the last layer back to the first. The paths found by
+// `cheapest_paths` share their common prefixes, so they're immutable lists
+// that share tails, and there are two implementations to choose from:
+//
+// - `Path` is a `LispyList` of `VertexState`. Each node is a full
+//   `VertexState` (16 bytes) plus a refcount and a pointer, 32 bytes in all
+//   on 64-bit platforms, with padding.
+// - `CompactPath` stores only the vertex of each node, with a 32-bit refcount
+//   and a 32-bit index of the next node, 12 bytes in all. The cost of a path
+//   is kept in the `CompactPath` itself, not in its nodes, since only the cost
+//   at the head of a path is ever needed. The nodes live in a per-thread
+//   `CompactPathStore`.
+//
+// Both must be used on the thread that made them. `SharedPath` is a `Path`
+// that can be shared between threads, at some cost (see `AtomicRefcount`).
+//
+// The two have the same interface, but a `CompactPath` knows only the cost at
+// its head: the `least_total_weight_to_here` of the later elements of a
+// `CompactPath`, and of the head of its `tail()`, is `unknown_total_weight`.
+//
+// Both are for graphs whose edge weights are `double`s. `BasicPath<Weight>`
+// and `BasicCompactPath<Weight>` are for graphs whose edges are
+// `BasicEdge<Weight>`s (see `layer.h`). Their total weights are
+// `TotalWeight<Weight>`s.
+
+#pragma once
+
+#include "lispylist.h"
+#include "nodepool.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// The total weight of a path is the sum of the weights of many edges, so
+// integers are totaled in 64 bits rather than risk overflow, and `float`s are
+// totaled as `double`s rather than lose precision with every layer.
+template <typename Weight>
+using TotalWeight = std::conditional_t<std::is_integral_v<Weight>, std::int64_t, double>;
+
+// Return the value that stands for a total weight that isn't known: NaN, or
+// for integers, the least value of the type.
+template <typename Total>
+constexpr Total unknown_total_weight() {
+  if constexpr (std::numeric_limits<Total>::has_quiet_NaN) {
+    return std::numeric_limits<Total>::quiet_NaN();
+  } else {
+    return std::numeric_limits<Total>::min();
+  }
+}
+
+template <typename Weight>
+struct BasicVertexState {
+  using weight_type = Weight; // of the edges of the graph
+
+  TotalWeight<Weight> least_total_weight_to_here;
+  int vertex; // as named by `BasicEdge::from` or `BasicEdge::to`
+};
+
+using VertexState = BasicVertexState<double>;
+
+// Path nodes are allocated and freed once per improving relaxation, so they
+// come from a `NodePool` instead of the heap. Nodes freed by pruned branches
+// are recycled by later relaxations.
+template <typename Weight>
+using BasicPath = LispyList<BasicVertexState<Weight>, PoolAllocator<BasicVertexState<Weight>>>;
+
+using Path = BasicPath<double>;
+
+// The sizes of the nodes as described above, and in the README, on 64-bit
+// platforms.
+static_assert(sizeof(void*) != 8 ||
+  (sizeof(LispyListNode<BasicVertexState<double>>) == 32 &&
+   sizeof(LispyListNode<BasicVertexState<float>>) == 32 &&
+   sizeof(LispyListNode<BasicVertexState<std::int32_t>>) == 32));
+
+// `BasicSharedPath` is a `BasicPath` whose nodes are refcounted atomically, and
+// allocated with `std::allocator`, so that paths that share nodes can be used
+// on different threads, e.g. paths can be handed to a consumer thread while
+// the solver carries on (see `AtomicRefcount`). It's slower than `BasicPath`.
+template <typename Weight>
+using BasicSharedPath = LispyList<BasicVertexState<Weight>, std::allocator<BasicVertexState<Weight>>, AtomicRefcount>;
+
+using SharedPath = BasicSharedPath<double>;
+
+// `CompactPathStore` holds the nodes of the `CompactPath`s of one thread, in
+// chunks that are never returned to the system until the thread exits. Nodes
+// are named by their index, and index zero is the empty list. As with
+// `LispyList`, a node whose refcount reaches zero is either freed right away
+// or, if reclamation is deferred, set aside to be freed by `reclaim`.
+class CompactPathStore {
+ public:
+  using Index = std::uint32_t;
+
+  struct Node {
+    std::int32_t vertex;
+    std::uint32_t refcount;
+    Index next; // or the next free node, when on the free list
+  };
+  static_assert(sizeof(Node) == 12);
+
+ private:
+  static constexpr int chunk_bits = 16;
+  static constexpr Index chunk_size = Index(1) << chunk_bits;
+
+  std::vector<std::unique_ptr<Node[]>> chunks;
+  Index never_used = 1; // the lowest index that has never been allocated
+  Index free_list = 0;
+  std::size_t live_nodes = 0;
+  bool deferred = false;
+  std::vector<Index> pending;
+
+  CompactPathStore() = default;
+
+ public:
+  CompactPathStore(const CompactPathStore&) = delete;
+  CompactPathStore& operator=(const CompactPathStore&) = delete;
+
+  static CompactPathStore& instance();
+
+  Node& operator[](Index index);
+
+  // Return the index of a new node having the specified `vertex` and `next`
+  // node, with a refcount of one. Each index can be used at most once by any
+  // number of lists, so throw `std::length_error` if there are already
+  // 2^32 - 1 live nodes.
+  Index allocate(int vertex, Index next);
+
+  // Drop a reference to the node at `index`, if any.
+  void release(Index index);
+
+  void defer_reclamation(bool defer);
+  bool reclamation_deferred() const;
+  std::size_t reclaim(std::size_t budget);
+  bool reclamation_pending() const;
+
+  // Return the number of nodes currently allocated.
+  std::size_t live() const;
+
+ private:
+  // Free `dead`, whose refcount has reached zero, and then each following
+  // node whose refcount thereby reaches zero, but free at most `budget`
+  // nodes, and deduct the number freed from `budget`. Return the first node
+  // that was due to be freed but wasn't, or zero if there's none.
+  Index free_chain(Index dead, std::size_t& budget);
+};
+
+template <typename Weight>
+class BasicCompactPathIterator;
+
+template <typename Weight>
+class BasicCompactPath {
+  using Index = CompactPathStore::Index;
+  using State = BasicVertexState<Weight>;
+  using Total = TotalWeight<Weight>;
+
+  Index node = 0;
+  Total cost = 0; // `least_total_weight_to_here` of the head
+
+  BasicCompactPath(Index node, Total cost);
+
+ public:
+  using value_type = State;
+
+  BasicCompactPath() = default;
+  BasicCompactPath(const BasicCompactPath&);
+  BasicCompactPath(BasicCompactPath&&);
+
+  ~BasicCompactPath();
+
+  BasicCompactPath& operator=(const BasicCompactPath& other);
+  BasicCompactPath& operator=(BasicCompactPath&& other);
+
+  State head() const;
+  BasicCompactPath tail() const;
+  bool empty() const;
+
+  // See `LispyList::prepend`.
+  BasicCompactPath prepend(State value) const&;
+  BasicCompactPath prepend(State value) &&;
+
+  // See `LispyList::detach_tail`.
+  BasicCompactPath detach_tail();
+
+  BasicCompactPathIterator<Weight> begin() const;
+  BasicCompactPathIterator<Weight> end() const;
+
+  // See `LispyList::defer_reclamation` and friends.
+  static void defer_reclamation(bool defer);
+  static bool reclamation_deferred();
+  static std::size_t reclaim(std::size_t budget);
+  static bool reclamation_pending();
+
+  bool operator==(const BasicCompactPath& other) const;
+  bool operator!=(const BasicCompactPath& other) const;
+};
+
+using CompactPath = BasicCompactPath<double>;
+
+// `BasicCompactPathIterator` is an input iterator over the states of a
+// `BasicCompactPath`. The states are made up as it goes, so a reference to one
+// is valid only until the iterator is next incremented.
+template <typename Weight>
+class BasicCompactPathIterator {
+  using State = BasicVertexState<Weight>;
+
+  CompactPathStore::Index node = 0;
+  State current{};
+
+ public:
+  using value_type = State;
+  using pointer = const State*;
+  using reference = const State&;
+  using iterator_category = std::input_iterator_tag;
+  using difference_type = std::ptrdiff_t;
+
+  BasicCompactPathIterator() = default;
+  BasicCompactPathIterator(CompactPathStore::Index node, TotalWeight<Weight> cost);
+
+  const State& operator*() const;
+  const State *operator->() const;
+  BasicCompactPathIterator& operator++();
+  BasicCompactPathIterator operator++(int);
+
+  // See `LispyListIterator::id`.
+  std::uintptr_t id() const;
+
+  bool operator==(const BasicCompactPathIterator& other) const;
+  bool operator!=(const BasicCompactPathIterator& other) const;
+};
+
+using CompactPathIterator = BasicCompactPathIterator<double>;
+
+// Implementation
+// ==============
+
+// class CompactPathStore
+// ----------------------
+inline CompactPathStore& CompactPathStore::instance() {
+  thread_local CompactPathStore store;
+  return store;
+}
+
+inline CompactPathStore::Node& CompactPathStore::operator[](Index index) {
+  return chunks[index >> chunk_bits][index & (chunk_size - 1)];
+}
+
+inline CompactPathStore::Index CompactPathStore::allocate(int vertex, Index next) {
+  Index index = free_list;
+  if (index) {
+    free_list = (*this)[index].next;
+  } else {
+    if (never_used == std::numeric_limits<Index>::max()) {
+      throw std::length_error("too many compact path nodes");
+    }
+    index = never_used++;
+    if ((index >> chunk_bits) == chunks.size()) {
+      chunks.emplace_back(new Node[chunk_size]);
+    }
+  }
+  ++live_nodes;
+  LISPYLIST_STAT(LispyListStats::instance().allocated());
+  (*this)[index] = Node{.vertex = vertex, .refcount = 1, .next = next};
+  return index;
+}
+
+inline void CompactPathStore::release(Index index) {
+  if (!index || --(*this)[index].refcount != 0) {
+    return;
+  }
+  if (deferred) {
+    pending.push_back(index);
+    return;
+  }
+  std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+  free_chain(index, unlimited);
+}
+
+inline CompactPathStore::Index CompactPathStore::free_chain(Index dead, std::size_t& budget) {
+  LISPYLIST_STAT(std::uint64_t freed = 0);
+  while (dead && budget) {
+    Node& node = (*this)[dead];
+    const Index next = node.next;
+    node.next = free_list;
+    free_list = dead;
+    --live_nodes;
+    --budget;
+    LISPYLIST_STAT(++freed);
+    dead = next && --(*this)[next].refcount == 0 ? next : 0;
+  }
+  LISPYLIST_STAT(LispyListStats::instance().freed(freed));
+  return dead;
+}
+
+inline void CompactPathStore::defer_reclamation(bool defer) {
+  deferred = defer;
+  if (!defer) {
+    reclaim(std::numeric_limits<std::size_t>::max());
+  }
+}
+
+inline bool CompactPathStore::reclamation_deferred() const {
+  return deferred;
+}
+
+inline std::size_t CompactPathStore::reclaim(std::size_t budget) {
+  const std::size_t initial_budget = budget;
+  while (budget && !pending.empty()) {
+    if (const Index rest = free_chain(pending.back(), budget)) {
+      pending.back() = rest;
+    } else {
+      pending.pop_back();
+    }
+  }
+  return initial_budget - budget;
+}
+
+inline bool CompactPathStore::reclamation_pending() const {
+  return !pending.empty();
+}
+
+inline std::size_t CompactPathStore::live() const {
+  return live_nodes;
+}
+
+// class BasicCompactPath<Weight>
+// --------------------------------
+template <typename Weight>
+BasicCompactPath<Weight>::BasicCompactPath(Index node, Total cost)
+: node(node)
+, cost(cost) {
+}
+
+template <typename Weight>
+BasicCompactPath<Weight>::BasicCompactPath(const BasicCompactPath& other)
+: node(other.node)
+, cost(other.cost) {
+  if (node) {
+    ++CompactPathStore::instance()[node].refcount;
+  }
+}
+
+template <typename Weight>
+BasicCompactPath<Weight>::BasicCompactPath(BasicCompactPath&& other)
+: node(std::exchange(other.node, 0))
+, cost(other.cost) {
+}
+
+template <typename Weight>
+BasicCompactPath<Weight>::~BasicCompactPath() {
+  if (node) {
+    CompactPathStore::instance().release(node);
+  }
+}
+
+template <typename Weight>
+BasicCompactPath<Weight>& BasicCompactPath<Weight>::operator=(const BasicCompactPath& other) {
+  if (&other == this) {
+    return *this;
+  }
+  CompactPathStore& store = CompactPathStore::instance();
+  if (other.node) {
+    ++store[other.node].refcount;
+  }
+  store.release(node);
+  node = other.node;
+  cost = other.cost;
+  return *this;
+}
+
+template <typename Weight>
+BasicCompactPath<Weight>& BasicCompactPath<Weight>::operator=(BasicCompactPath&& other) {
+  if (&other == this) {
+    return *this;
+  }
+  CompactPathStore::instance().release(node);
+  node = std::exchange(other.node, 0);
+  cost = other.cost;
+  return *this;
+}
+
+template <typename Weight>
+BasicVertexState<Weight> BasicCompactPath<Weight>::head() const {
+  assert(node);
+  return BasicVertexState<Weight>{
+    .least_total_weight_to_here = cost,
+    .vertex = CompactPathStore::instance()[node].vertex
+  };
+}
+
+template <typename Weight>
+BasicCompactPath<Weight> BasicCompactPath<Weight>::tail() const {
+  assert(node);
+  CompactPathStore& store = CompactPathStore::instance();
+  const Index next = store[node].next;
+  if (next) {
+    ++store[next].refcount;
+  }
+  return BasicCompactPath(next, unknown_total_weight<Total>());
+}
+
+template <typename Weight>
+bool BasicCompactPath<Weight>::empty() const {
+  return node == 0;
+}
+
+template <typename Weight>
+BasicCompactPath<Weight> BasicCompactPath<Weight>::prepend(State value) const& {
+  CompactPathStore& store = CompactPathStore::instance();
+  if (node) {
+    ++store[node].refcount;
+  }
+  return BasicCompactPath(
+    store.allocate(value.vertex, node),
+    value.least_total_weight_to_here);
+}
+
+template <typename Weight>
+BasicCompactPath<Weight> BasicCompactPath<Weight>::prepend(State value) && {
+  // The reference that this path held to `node` now belongs to the new node.
+  const Index first = CompactPathStore::instance().allocate(value.vertex, node);
+  node = 0;
+  return BasicCompactPath(first, value.least_total_weight_to_here);
+}
+
+template <typename Weight>
+BasicCompactPath<Weight> BasicCompactPath<Weight>::detach_tail() {
+  assert(node);
+  // The reference that `node` held to its tail now belongs to the result.
+  CompactPathStore::Node& head = CompactPathStore::instance()[node];
+  const Index tail = head.next;
+  head.next = 0;
+  return BasicCompactPath(tail, unknown_total_weight<Total>());
+}
+
+template <typename Weight>
+BasicCompactPathIterator<Weight> BasicCompactPath<Weight>::begin() const {
+  return BasicCompactPathIterator<Weight>(node, cost);
+}
+
+template <typename Weight>
+BasicCompactPathIterator<Weight> BasicCompactPath<Weight>::end() const {
+  return BasicCompactPathIterator<Weight>();
+}
+
+template <typename Weight>
+void BasicCompactPath<Weight>::defer_reclamation(bool defer) {
+  CompactPathStore::instance().defer_reclamation(defer);
+}
+
+template <typename Weight>
+bool BasicCompactPath<Weight>::reclamation_deferred() {
+  return CompactPathStore::instance().reclamation_deferred();
+}
+
+template <typename Weight>
+std::size_t BasicCompactPath<Weight>::reclaim(std::size_t budget) {
+  return CompactPathStore::instance().reclaim(budget);
+}
+
+template <typename Weight>
+bool BasicCompactPath<Weight>::reclamation_pending() {
+  return CompactPathStore::instance().reclamation_pending();
+}
+
+template <typename Weight>
+bool BasicCompactPath<Weight>::operator==(const BasicCompactPath& other) const {
+  return node == other.node;
+}
+
+template <typename Weight>
+bool BasicCompactPath<Weight>::operator!=(const BasicCompactPath& other) const {
+  return node != other.node;
+}
+
+// class BasicCompactPathIterator<Weight>
+// ----------------------------------------
+template <typename Weight>
+BasicCompactPathIterator<Weight>::BasicCompactPathIterator(
+    CompactPathStore::Index node,
+    TotalWeight<Weight> cost)
+: node(node) {
+  if (node) {
+    current = BasicVertexState<Weight>{
+      .least_total_weight_to_here = cost,
+      .vertex = CompactPathStore::instance()[node].vertex
+    };
+  }
+}
+
+template <typename Weight>
+const BasicVertexState<Weight>& BasicCompactPathIterator<Weight>::operator*() const {
+  assert(node);
+  return current;
+}
+
+template <typename Weight>
+const BasicVertexState<Weight> *BasicCompactPathIterator<Weight>::operator->() const {
+  return &**this;
+}
+
+template <typename Weight>
+BasicCompactPathIterator<Weight>& BasicCompactPathIterator<Weight>::operator++() {
+  if (node) {
+    *this = BasicCompactPathIterator(
+      CompactPathStore::instance()[node].next,
+      unknown_total_weight<TotalWeight<Weight>>());
+  }
+  return *this;
+}
+
+template <typename Weight>
+BasicCompactPathIterator<Weight> BasicCompactPathIterator<Weight>::operator++(int) {
+  auto copy = *this;
+  ++*this;
+  return copy;
+}
+
+template <typename Weight>
+std::uintptr_t BasicCompactPathIterator<Weight>::id() const {
+  return node;
+}
+
+template <typename Weight>
+bool BasicCompactPathIterator<Weight>::operator==(const BasicCompactPathIterator& other) const {
+  return node == other.node;
+}
+
+template <typename Weight>
+bool BasicCompactPathIterator<Weight>::operator!=(const BasicCompactPathIterator& other) const {
+  return node != other.node;
+}
@@ -1,17 +1,39 @@
+// `randomgraph` prints a random layered graph in the text format read by
+// `shortestpath`.
+//
+// The shape of the graph is configured by environment variables, each of which
+// is either "MEAN" or "MEAN,STANDARD_DEVIATION" of a normal distribution:
+//
+// - `LAYERS` is the number of layers of vertices (default "10,3", at least 2).
+//   `LAYERS=inf` prints layers forever.
+// - `WIDTH` is the number of vertices in each layer (default "5,2", at least
+//   1).
+// - `FAN_IN` is the number of edges into each vertex (default "3,1", at least
+//   1).
+// - `WEIGHT` is the weight of each edge (default "5,20").
+//
+// Weights are printed with `WEIGHT_DIGITS` significant digits (default 2). If
+// `INTEGER_WEIGHTS=1`, then weights are rounded to integers instead.
+// `RAND_SEED` seeds the random number generator (default 42).
+
 #include <algorithm>
-#include <iomanip>
-#include <iostream>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <iostream>
+#include <limits>
 #include <random>
+#include <streambuf>
+#include <string_view>
+#include <vector>
 
 class LowerBoundedIntegerNormalDistribution {
   std::normal_distribution<> distribution;
   int lower_bound;
 
 public:
-  LowerBoundedIntegerNormalDistribution(int lower_bound, int mean, double standard_deviation)
+  LowerBoundedIntegerNormalDistribution(int lower_bound, double mean, double standard_deviation)
   : distribution(mean, standard_deviation)
   , lower_bound(lower_bound) {}
 
@@ -21,31 +43,133 @@ public:
   }
 };
 
+struct NormalParameters {
+  double mean;
+  double standard_deviation;
+};
+
+// Return the normal distribution parameters in the environment variable having
+// the specified `name`, or return `defaults` if the variable is not set. If
+// only the mean is specified, then the standard deviation is zero.
+NormalParameters normal_option(const char *name, NormalParameters defaults) {
+  const char *const raw = std::getenv(name);
+  if (!raw) {
+    return defaults;
+  }
+  char *rest;
+  NormalParameters result;
+  result.mean = std::strtod(raw, &rest);
+  result.standard_deviation = *rest == ',' ? std::strtod(rest + 1, nullptr) : 0.0;
+  return result;
+}
+
+// `Output` buffers text in a large buffer and writes it to a `std::streambuf`
+// in big chunks. Numbers are formatted using `std::to_chars`.
+class Output {
+  std::streambuf *destination;
+  std::vector<char> buffer;
+  std::size_t used = 0;
+
+  // Room for the longest thing we write at once.
+  static constexpr std::size_t max_item_size = 64;
+
+  char *reserve() {
+    if (buffer.size() - used < max_item_size) {
+      flush();
+    }
+    return buffer.data() + used;
+  }
+
+public:
+  explicit Output(std::streambuf *destination)
+  : destination(destination)
+  , buffer(1 << 20) {}
+
+  ~Output() {
+    flush();
+  }
+
+  void flush() {
+    destination->sputn(buffer.data(), used);
+    used = 0;
+  }
+
+  void put(char character) {
+    *reserve() = character;
+    ++used;
+  }
+
+  void put(int value) {
+    char *const begin = reserve();
+    used += std::to_chars(begin, begin + max_item_size, value).ptr - begin;
+  }
+
+  // Print `value` as `std::ostream` would with `std::setprecision(precision)`.
+  void put(double value, int precision) {
+    char *const begin = reserve();
+    used += std::to_chars(
+      begin, begin + max_item_size, value, std::chars_format::general, precision).ptr - begin;
+  }
+};
+
 int main() {
+  std::ios::sync_with_stdio(false);
+
   const std::uint32_t seed = []() {
     if (const char *const raw = std::getenv("RAND_SEED")) {
       return std::atoi(raw);
     }
     return 42;
   }();
+  const bool forever = [] {
+    const char *const raw = std::getenv("LAYERS");
+    return raw && std::string_view{raw} == "inf";
+  }();
+  const NormalParameters layers_parameters = forever
+    ? NormalParameters{2, 0}
+    : normal_option("LAYERS", {10, 3.0});
+  const NormalParameters width = normal_option("WIDTH", {5, 2.0});
+  const NormalParameters fan_in = normal_option("FAN_IN", {3, 1.0});
+  const NormalParameters weight = normal_option("WEIGHT", {5.0, 20.0});
+  const int weight_digits = [] {
+    if (const char *const raw = std::getenv("WEIGHT_DIGITS")) {
+      return std::clamp(std::atoi(raw), 1, 17);
+    }
+    return 2;
+  }();
+  const bool integer_weights = [] {
+    const char *const raw = std::getenv("INTEGER_WEIGHTS");
+    return raw && std::string_view{raw} == "1";
+  }();
+
   std::mt19937 generator{seed};
-  LowerBoundedIntegerNormalDistribution layers{2, 10, 3.0};
-  LowerBoundedIntegerNormalDistribution vertices_per_layer{1, 5, 2.0};
-  LowerBoundedIntegerNormalDistribution inward_edges_per_vertex{1, 3, 1.0};
-  std::normal_distribution<> edge_weight{5.0, 20.0};
+  LowerBoundedIntegerNormalDistribution layers{2, layers_parameters.mean, layers_parameters.standard_deviation};
+  LowerBoundedIntegerNormalDistribution vertices_per_layer{1, width.mean, width.standard_deviation};
+  LowerBoundedIntegerNormalDistribution inward_edges_per_vertex{1, fan_in.mean, fan_in.standard_deviation};
+  std::normal_distribution<> edge_weight{weight.mean, weight.standard_deviation};
 
-  const int num_layers = layers(generator);
+  Output output{std::cout.rdbuf()};
+  const int num_layers = forever ? std::numeric_limits<int>::max() : layers(generator);
   int num_vertices_previous = vertices_per_layer(generator);
-  for (int i = 1; i < num_layers; ++i) {
+  for (std::int64_t i = 1; forever || i < num_layers; ++i) {
     const int num_vertices = vertices_per_layer(generator);
     std::uniform_int_distribution from{0, num_vertices_previous - 1};
     for (int to = 0; to < num_vertices; ++to) {
       const int inward_edges = inward_edges_per_vertex(generator);
       for (int edge = 0; edge < inward_edges; ++edge) {
-        std::cout << from(generator) << ' ' << to << ' ' << std::setprecision(2) << edge_weight(generator) << '\t';
+        output.put(from(generator));
+        output.put(' ');
+        output.put(to);
+        output.put(' ');
+        if (integer_weights) {
+          output.put(int(std::round(edge_weight(generator))));
+        } else {
+          output.put(edge_weight(generator), weight_digits);
+        }
+        output.put('\t');
       }
     }
-    std::cout << '\n';
+    output.put('\n');
     num_vertices_previous = num_vertices;
   }
 }
@@ -1,331 +1,826 @@
-#include "lispylist.h"
+#include "shortestpath.h"
 #include <algorithm>
-#include <cassert>
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <istream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <ostream>
-#include <string_view>
+#include <span>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
 
-std::ostream debug{nullptr};
-
-struct Edge {
-  int from; // vertex name, `>= 0`
-  int to; // vertex name, `>= 0`
-  double weight; // a real number
-};
-
-struct VertexState {
-  double least_total_weight_to_here;
-  int vertex; // as named by `Edge::from` or `Edge::to`
-};
-
-template <typename EdgeRangeIterator>
-std::vector<LispyList<VertexState>> cheapest_paths(
-    EdgeRangeIterator layer,
-    EdgeRangeIterator layers_end) {
-  // `nil` is a handy shorthand for the "empty" or "end" lispy list.
-  const LispyList<VertexState> nil;
-
-  // `*layer` can be unpacked as two forward iterators to `Edge`.
-  // The idea is that a layer is represented as a sequence of edges from the
-  // previous layer to the the current layer, and `[layer, layers_end)` is a
-  // sequence of layers.
-  // The sequences of edges are covered by forward iterators, while `layer` is
-  // an input iterator (so layers can be generated lazily).
-  std::vector<LispyList<VertexState>> previous_layer;
-  std::vector<LispyList<VertexState>> current_layer;
-  int layer_count = 1;
-  for (; layer != layers_end; ++layer, ++layer_count) {
-    debug << "Examining layer " << layer_count << '\n';
-    // Deduce which vertices are in a layer by examining the vertices named in
-    // the edges between the two layers.
-    int max_previous_vertex = -1;
-    int max_current_vertex = -1;
-    const auto [edges_begin, edges_end] = *layer;
-    for (auto iter = edges_begin; iter != edges_end; ++iter) {
-      const Edge& edge = *iter;
-      max_previous_vertex = std::max(max_previous_vertex, edge.from);
-      max_current_vertex = std::max(max_current_vertex, edge.to);
-    }
-    previous_layer.resize(max_previous_vertex + 1);
-    current_layer.clear();
-    current_layer.resize(max_current_vertex + 1);
-    debug << "    previous layer has " << previous_layer.size() << " vertices\n";
-    debug << "    current layer has " << current_layer.size() << " vertices\n";
-
-    // Update `current_layer` (and `previous_layer`, if necessary) based on the
-    // edges between the two layers.
-    for (auto iter = edges_begin; iter != edges_end; ++iter) {
-      const auto [from, to, weight] = *iter;
-      if (previous_layer[from] == nil) {
-        debug << "    previous vertex " << from << " now has minimum weight zero\n";
-        previous_layer[from] = nil.prepend(VertexState{
-          .least_total_weight_to_here = 0,
-          .vertex = from
-        });
-      }
-      const VertexState& previous = previous_layer[from].head();
-      const double proposed_total = previous.least_total_weight_to_here + weight;
-      if (current_layer[to] == nil || current_layer[to].head().least_total_weight_to_here > proposed_total) {
-        debug << "    current vertex " << to << " now has minimum weight " << proposed_total << '\n';
-        current_layer[to] = previous_layer[from].prepend(VertexState{
-          .least_total_weight_to_here = proposed_total,
-          .vertex = to
-        });
-      }
-    }
+#include <unistd.h>
+
+// Set by the SIGUSR1 handler (see `METRICS` in `main`), and cleared once the
+// metrics have been printed.
+volatile std::sig_atomic_t metrics_requested = 0;
 
-    using std::swap;
-    swap(previous_layer, current_layer);
+extern "C" void request_metrics(int) {
+  metrics_requested = 1;
+}
+
+// If SIGUSR1 has asked for a summary of `metrics`, and it's not null, then
+// print one to standard error.
+void print_requested_metrics(const LayerMetrics *metrics) {
+  if (metrics_requested && metrics) {
+    metrics_requested = 0;
+    metrics->print(std::cerr);
   }
+}
 
-  // Now `previous_layer` contains the information about the vertices in the
-  // final layer. Sort by `least_total_weight_to_here` and return all of the
-  // paths that have the minimal total weight.
-  struct ByTotalWeight {
-    bool operator()(
-        const LispyList<VertexState>& left,
-        const LispyList<VertexState>& right) const {
-      // Order by `least_total_weight_to_here`, with empty lists last.
-      if (left.empty()) {
-        return false;
+// Print the specified optimal `path` to `output` as one line: the path's total
+// weight followed by its vertices, one per layer, starting with layer 0.
+template <typename PathType>
+void print_path(const PathType& path, std::vector<int>& vertices_scratch, std::ostream& output) {
+  std::vector<int>& vertices = vertices_scratch;
+  vertices.clear();
+  for (const auto& state : path) {
+    vertices.push_back(state.vertex);
+  }
+  output << path.head().least_total_weight_to_here;
+  for (auto vertex = vertices.rbegin(); vertex != vertices.rend(); ++vertex) {
+    output << ' ' << *vertex;
+  }
+  output << '\n';
+}
+
+// Print the first of the specified `paths` to `output` as `print_path` does,
+// or an empty line if there are no paths.
+template <typename PathType>
+void print_first_path(
+    const std::vector<PathType>& paths,
+    std::vector<int>& vertices_scratch,
+    std::ostream& output) {
+  if (paths.empty()) {
+    output << '\n';
+  } else {
+    print_path(paths.front(), vertices_scratch, output);
+  }
+}
+
+// Print to `output` the Graphviz edges that highlight the specified optimal
+// `paths`, which pass through `num_layers` layers of vertices, i.e. one more
+// than the number of layers of edges.
+//
+// If `once`, then each edge is printed only once, however many of the paths
+// contain it. The paths share their common prefixes (see `paths.h`), so once
+// the walk back along a path reaches a node that an earlier path walked
+// through, the rest of the path has been printed already, and the walk stops
+// there. Then each node is visited once, rather than once for every path that
+// contains it.
+template <typename PathType>
+void print_dot_paths(const std::vector<PathType>& paths, int num_layers, bool once, DotWriter& output) {
+  std::unordered_set<std::uintptr_t> visited; // node ids, if `once`
+  for (int i = 0; i < int(paths.size()); ++i) {
+    const PathType& list = paths[i];
+    int current_layer = num_layers - 1;
+    debug << "weight " << list.head().least_total_weight_to_here << ':';
+    int to = -1;
+    int from = -1;
+    for (auto it = list.begin(); it != list.end(); ++it, --current_layer) {
+      // debug << "current layer is " << current_layer << '\n';
+      debug << " -> " << it->vertex;
+      const bool seen = once && !visited.insert(it.id()).second;
+      if (to == -1) {
+        to = it->vertex;
+        if (seen) {
+          break;
+        }
+        continue;
+      } else if (from == -1) {
+        from = it->vertex;
+      } else {
+        to = from;
+        from = it->vertex;
       }
-      if (right.empty()) {
-        return true;
+      output <<
+    "  " << DotNodePrefix{current_layer} << from << " -> " << DotNodePrefix{current_layer + 1} << to << " [penwidth=\"3\", color=\"red\"];\n";
+      if (seen) {
+        break;
       }
-      return left.head().least_total_weight_to_here < right.head().least_total_weight_to_here;
     }
-  };
+    // output <<
+    // "  node_0_" << from << " -> node_1_" << to << " [penwidth=\"3\", color=\"red\"];\n";
+    debug << '\n';
+  }
+}
 
-  std::sort(previous_layer.begin(), previous_layer.end(), ByTotalWeight{});
-  assert(!previous_layer.empty());
-  assert(!previous_layer[0].empty());
-  const double least_total_weight = previous_layer[0].head().least_total_weight_to_here;
-  const auto end_least = std::find_if(
-    previous_layer.begin(),
-    previous_layer.end(),
-    [=](const LispyList<VertexState>& list) {
-      return list.empty() || list.head().least_total_weight_to_here != least_total_weight;
+// Solve each graph of the batch read from `input` (see `is_graph_separator`),
+// and print the first of each graph's optimal paths to `output` (see
+// `print_path`), one line per graph, in the order that the graphs were read.
+// The line is empty if a graph has no paths, e.g. because beam search pruned
+// them all, or if it has no layers, e.g. because its first layer or a header
+// line is malformed, which is also reported to standard error. Each graph can
+// have its own header (see `is_graph_header`).
+// Separators with no layers between them don't count as graphs. If `threads`
+// is more than one, then that many graphs are solved at a time, each on a
+// single thread. Return the number of graphs whose results aren't provably
+// optimal (see `CheapestPathsSolver::provably_optimal`).
+template <typename PathType>
+std::size_t solve_batch(
+    std::istream& input,
+    const SolveOptions& options,
+    int threads,
+    std::ostream& output) {
+  using Weight = typename PathType::value_type::weight_type;
+  using LayerIterator = BasicLayerIterator<Weight>;
+  const auto state = std::make_shared<BasicLayerGeneratorState<Weight>>(BasicLayerGeneratorState<Weight>{
+    .incoming = {},
+    .header = {},
+    .input = LineReader{input},
+    .graphviz = nullptr,
+    .vertices_scratch = {},
+    .layer = 0,
+    .batch = true
   });
-  previous_layer.erase(end_least, previous_layer.end());
-  return previous_layer;
-}
 
-void print_layer_subgraph(
-    int layer,
-    const std::vector<int>& vertices,
-    std::ostream& graphviz) {
-  graphviz <<
-    "\n"
-    "  subgraph cluster_" << layer << " {\n"
-    "    style=filled;\n"
-    "    color=lightgrey;\n"
-    "    node [style=filled, color=white];\n"
-    "    label = \"Layer " << layer << "\";\n"
-    "\n";
-  for (const int vertex : vertices) {
-    graphviz <<
-    "    node_" << layer << "_" << vertex << " [label=\"" << vertex << "\"];\n";
+  // Warn about the graph numbered `graph`, counting from one, if it was cut
+  // short at a line that couldn't be parsed before any of its layers were.
+  const auto warn_unparsed = [](std::size_t graph) {
+    std::cerr << "Graph " << graph << " of the batch has no layers, because a line of it is malformed\n";
+  };
+
+  std::size_t not_optimal = 0;
+  std::size_t graphs = 0;
+  if (threads <= 1) {
+    CheapestPathsSolver<PathType> solver{options};
+    std::vector<int> vertices_scratch;
+    while (!state->exhausted) {
+      solver.reset();
+      LayerIterator layer{state};
+      solver.set_initial_costs(state->header.initial);
+      solver.set_terminal_costs(state->header.terminal);
+      for (; layer != LayerIterator{}; ++layer) {
+        const auto [begin, end] = *layer;
+        solver.push_layer(begin, end);
+      }
+      if (solver.layers()) {
+        ++graphs;
+        print_first_path(solver.result(), vertices_scratch, output);
+        not_optimal += !solver.provably_optimal();
+      } else if (state->present) {
+        ++graphs;
+        if (state->malformed) {
+          warn_unparsed(graphs);
+        }
+        output << '\n';
+      }
+      print_requested_metrics(options.metrics);
+    }
+    return not_optimal;
   }
-  graphviz <<
-    "  }\n";
-}
 
-bool read_layer(
-    std::istream& lines,
-    std::string& buffer,
-    std::istringstream& buffer_stream,
-    std::vector<Edge>& destination,
-    std::ostream& graphviz,
-    std::vector<int>& vertices_scratch,
-    int layer) {
-  destination.clear();
+  // Otherwise, read a round of graphs into memory, solve them all on
+  // `threads` threads, print their results in order, and repeat. The buffers
+  // of each round are reused by the next.
+  struct Job {
+    std::vector<std::vector<BasicEdge<Weight>>> layers; // only the first `layer_count`
+    std::size_t layer_count;
+    BasicGraphHeader<Weight> header;
+    bool malformed; // whether it has no layers because of a malformed line
+    std::string result;
+    bool provably_optimal;
+  };
+  std::vector<Job> jobs(std::size_t(threads) * 256);
+  SolveOptions job_options = options;
+  job_options.threads = 1;
+  while (!state->exhausted) {
+    std::size_t job_count = 0;
+    while (job_count != jobs.size() && !state->exhausted) {
+      Job& job = jobs[job_count];
+      job.layer_count = 0;
+      LayerIterator layer{state};
+      job.header = state->header;
+      for (; layer != LayerIterator{}; ++layer) {
+        if (job.layer_count == job.layers.size()) {
+          job.layers.emplace_back();
+        }
+        const auto [begin, end] = *layer;
+        job.layers[job.layer_count++].assign(begin, end);
+      }
+      job.malformed = !job.layer_count && state->malformed;
+      if (job.layer_count || state->present) {
+        ++job_count;
+      }
+    }
+    if (job_count == 0) {
+      break;
+    }
 
-  if (!std::getline(lines, buffer)) {
-    return false;
+    std::atomic<std::size_t> next_job = 0;
+    run_on_threads(std::min<std::size_t>(threads, job_count), [&](int) {
+      CheapestPathsSolver<PathType> solver{job_options};
+      std::vector<int> vertices_scratch;
+      std::ostringstream line;
+      for (std::size_t i; (i = next_job++) < job_count;) {
+        Job& job = jobs[i];
+        if (!job.layer_count) {
+          job.result = "\n";
+          job.provably_optimal = true;
+          continue;
+        }
+        solver.reset();
+        solver.set_initial_costs(job.header.initial);
+        solver.set_terminal_costs(job.header.terminal);
+        for (std::size_t layer = 0; layer != job.layer_count; ++layer) {
+          solver.push_layer(job.layers[layer]);
+        }
+        line.str({});
+        print_first_path(solver.result(), vertices_scratch, line);
+        job.result = line.str();
+        job.provably_optimal = solver.provably_optimal();
+      }
+    });
+    for (std::size_t i = 0; i != job_count; ++i) {
+      ++graphs;
+      if (jobs[i].malformed) {
+        warn_unparsed(graphs);
+      }
+      output << jobs[i].result;
+      not_optimal += !jobs[i].provably_optimal;
+    }
   }
-  buffer_stream.clear();
-  buffer_stream.str(buffer);
-
-  int from;
-  int to;
-  double weight;
-  for (;;) {
-    buffer_stream >> from;
-    if (!buffer_stream) {
-      break;
+  return not_optimal;
+}
+
+// Skip the first `count` bytes of `input`, by seeking if it can, e.g. if it's
+// a regular file, or else by reading them, and assign the last line of them,
+// without its newline, to `last_line`. Return `false` if the input is shorter
+// than that.
+bool skip_input(std::istream& input, std::uint64_t count, std::string& last_line) {
+  std::streambuf& buffer = *input.rdbuf();
+  last_line.clear();
+  const std::streampos size = buffer.pubseekoff(0, std::ios::end, std::ios::in);
+  if (size != std::streampos(-1)) {
+    if (std::uint64_t(size) < count) {
+      return false;
     }
-    buffer_stream >> to >> weight;
-    if (!buffer_stream) {
+    // Read back from `count` a window at a time, twice as much each time,
+    // until the window has the whole of the last line.
+    std::string window;
+    for (std::uint64_t length = 256;; length *= 2) {
+      const std::uint64_t begin = count > length ? count - length : 0;
+      window.resize(count - begin);
+      if (buffer.pubseekpos(begin, std::ios::in) != std::streampos(begin) ||
+          buffer.sgetn(window.data(), std::streamsize(window.size())) != std::streamsize(window.size())) {
+        return false;
+      }
+      std::string_view text = window;
+      if (text.ends_with('\n')) {
+        text.remove_suffix(1);
+      }
+      const std::size_t newline = text.rfind('\n');
+      if (newline != std::string_view::npos || begin == 0) {
+        last_line = text.substr(newline == std::string_view::npos ? 0 : newline + 1);
+        break;
+      }
+    }
+    return buffer.pubseekpos(count, std::ios::in) == std::streampos(count);
+  }
+  std::string line; // what's been read since the last newline
+  char chunk[1 << 16];
+  while (count) {
+    const std::streamsize read =
+      buffer.sgetn(chunk, std::streamsize(std::min<std::uint64_t>(count, sizeof chunk)));
+    if (read <= 0) {
       return false;
     }
-    destination.push_back(Edge{.from = from, .to = to, .weight = weight});
+    const char *begin = chunk;
+    const char *const end = chunk + read;
+    while (const void *newline = std::memchr(begin, '\n', end - begin)) {
+      line.append(begin, static_cast<const char*>(newline));
+      last_line.swap(line);
+      line.clear();
+      begin = static_cast<const char*>(newline) + 1;
+    }
+    line.append(begin, end);
+    count -= read;
   }
+  if (!line.empty()) {
+    last_line.swap(line);
+  }
+  return true;
+}
 
-  // Append graph output:
+// Return the value of the environment variable having the specified `name`
+// as an integer, or return `default_value` if the variable is not set.
+long integer_option(const char *name, long default_value) {
+  if (const char *raw = std::getenv(name)) {
+    return std::atol(raw);
+  }
+  return default_value;
+}
 
-  // We'll use `vertices` to determine the distinct `from` vertices (at least
-  // for the first layer) and `to` vertices (for all layers).
-  std::vector<int>& vertices = vertices_scratch;
+int main() {
+  // We don't mix C stdio with iostreams, and unsynchronized streams are faster.
+  std::ios::sync_with_stdio(false);
 
-  if (layer == 1) {
-    // Edges go from layer n-1 to layer n. If this is layer 1, then we have to
-    // state the nodes for layer 0 first.
-    for (const Edge& edge : destination) {
-      vertices.push_back(edge.from);
+  if (const char *raw = std::getenv("DEBUG")) {
+    if (std::string_view{raw} == "1") {
+      debug.rdbuf(std::cerr.rdbuf());
     }
-    std::sort(vertices.begin(), vertices.end());
-    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
-    print_layer_subgraph(0, vertices, graphviz);
-    vertices.clear();
   }
 
-  // Print the "to" vertices.
-  for (const Edge& edge : destination) {
-    vertices.push_back(edge.to);
+  // `FORMAT=dot` (the default) prints the whole graph in Graphviz format, with
+  // the optimal paths highlighted. `FORMAT=dag` prints only the edges of the
+  // optimal paths, each once, so that many tied paths make a graph of their
+  // union rather than a copy of each (see `print_dot_paths`). `FORMAT=path`
+  // skips all of that and prints only the optimal paths (see `print_path`).
+  const std::string_view format = [] {
+    const char *raw = std::getenv("FORMAT");
+    return std::string_view{raw ? raw : "dot"};
+  }();
+  if (format != "dot" && format != "dag" && format != "path") {
+    std::cerr << "FORMAT must be one of \"dot\", \"dag\", or \"path\", but got \"" << format << "\"\n";
+    return 1;
   }
-  std::sort(vertices.begin(), vertices.end());
-  vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
-  print_layer_subgraph(layer, vertices, graphviz);
 
-  // Print all of the edges.
-  graphviz <<
-    "\n";
-  for (const Edge& edge : destination) {
-    graphviz <<
-    "  node_" << (layer - 1) << "_" << edge.from << " -> node_" << layer << "_" << edge.to << " [label=\"" << edge.weight << "\"]\n";
+  // `THREADS` is how many threads to use for relaxing wide layers. It's the
+  // number of CPUs by default. `PARALLEL_MIN_EDGES` is how many edges a layer
+  // must have to be considered wide.
+  SolveOptions options;
+  options.threads = std::max(1L, integer_option(
+    "THREADS", std::max(1U, std::thread::hardware_concurrency())));
+  options.parallel_min_edges = std::max(1L, integer_option(
+    "PARALLEL_MIN_EDGES", options.parallel_min_edges));
+  // `DENSE_MIN_EDGES` is how many edges a layer must have to be checked for
+  // being complete bipartite (see `SolveOptions::dense_min_edges`). Zero
+  // disables the check.
+  options.dense_min_edges = std::max(0L, integer_option(
+    "DENSE_MIN_EDGES", options.dense_min_edges));
+
+  // `VERTEX_IDS` is "dense", "sparse", or "auto" (the default). Sparse vertex
+  // names are looked up in a hash table, rather than used as array indices,
+  // so that naming a vertex 2,000,000,000 doesn't cost gigabytes (see
+  // `SolveOptions::vertex_ids`).
+  if (const char *raw = std::getenv("VERTEX_IDS")) {
+    const std::string_view name{raw};
+    if (name == "dense") {
+      options.vertex_ids = VertexIds::dense;
+    } else if (name == "sparse") {
+      options.vertex_ids = VertexIds::sparse;
+    } else if (name != "auto") {
+      std::cerr << "VERTEX_IDS must be one of \"dense\", \"sparse\", or \"auto\", but got \"" << name << "\"\n";
+      return 1;
+    }
   }
 
-  vertices.clear();
+  // `BEAM_WIDTH=B` keeps only the B best vertices of each layer, and
+  // `BEAM_MARGIN=M` only those within M of the best, which might cost the
+  // optimal paths (see `SolveOptions::beam_width`). Whether they did is
+  // reported to standard error.
+  options.beam_width = std::max(0L, integer_option("BEAM_WIDTH", 0));
+  if (const char *raw = std::getenv("BEAM_MARGIN")) {
+    options.beam_margin = std::strtod(raw, nullptr);
+    if (!(options.beam_margin >= 0)) {
+      std::cerr << "BEAM_MARGIN must be a nonnegative number, but got \"" << raw << "\"\n";
+      return 1;
+    }
+  }
+  const bool beam = options.beam_width ||
+    options.beam_margin < std::numeric_limits<double>::infinity();
+
+  // `STREAM=1` prints the parts of the optimal paths that are final as soon as
+  // they're known, as lines of the form "commit FIRST_LAYER VERTEX...", where
+  // FIRST_LAYER is the layer of the first VERTEX. Each path printed at the end
+  // then continues where the last commit left off. The check for final parts
+  // happens every `COMMIT_INTERVAL` layers. `STREAM=1` requires `FORMAT=path`.
+  if (const char *raw = std::getenv("STREAM"); raw && std::string_view{raw} == "1") {
+    if (format != "path") {
+      std::cerr << "STREAM=1 requires FORMAT=path\n";
+      return 1;
+    }
+    options.commit_interval = std::max(1L, integer_option("COMMIT_INTERVAL", 64));
+    options.on_commit = [](int first_layer, const std::vector<int>& vertices) {
+      std::cout << "commit " << first_layer;
+      for (const int vertex : vertices) {
+        std::cout << ' ' << vertex;
+      }
+      std::cout << std::endl;
+    };
+  }
 
-  return true;
-}
+  // `STATS_INTERVAL=N` prints path node statistics to standard error every N
+  // layers, provided that we were built with `make STATS=1`.
+  if (const long interval = integer_option("STATS_INTERVAL", 0); interval > 0) {
+#ifndef LISPYLIST_STATS
+    std::cerr << "STATS_INTERVAL has no effect unless built with LISPYLIST_STATS defined (make STATS=1)\n";
+#endif
+    options.stats = &std::cerr;
+    options.stats_interval = interval;
+  }
 
-struct LayerGeneratorState {
-  std::vector<Edge> incoming;
-  std::istream& input;
-  std::string buffer;
-  std::istringstream buffer_stream;
-  std::ostream& graphviz;
-  std::vector<int> vertices_scratch;
-  int layer;
-};
-
-class LayerIterator {
-  std::shared_ptr<LayerGeneratorState> state;
-
-public:
-  LayerIterator()
-  : state(nullptr) {
+  // `METRICS=1` records the timings and counts of each layer, and prints
+  // their percentiles to standard error at the end, and whenever SIGUSR1
+  // arrives, provided that we were built with `make METRICS=1` (see
+  // `LayerMetrics`). It doesn't work with `BATCH_THREADS` or `CHUNKS`, which
+  // solve on many threads at once.
+  std::optional<LayerMetrics> metrics;
+  if (const char *raw = std::getenv("METRICS"); raw && std::string_view{raw} == "1") {
+#ifndef SHORTESTPATH_METRICS
+    std::cerr << "METRICS has no effect unless built with SHORTESTPATH_METRICS defined (make METRICS=1)\n";
+#endif
+    metrics.emplace();
+    options.metrics = &*metrics;
+    std::signal(SIGUSR1, request_metrics);
   }
-  explicit LayerIterator(std::istream& input, std::ostream& graphviz)
-  : state(new LayerGeneratorState{
-      .incoming = {},
-      .input = input,
-      .buffer = {},
-      .buffer_stream = {},
-      .graphviz = graphviz,
-      .vertices_scratch = {},
-      .layer = 0
-    }) {
-    // Get the initial layer.
-    ++(*this);
+
+  // `RECLAIM_BUDGET=N` frees pruned paths incrementally, at least N nodes per
+  // layer, instead of all at once.
+  options.reclaim_budget = std::max(0L, integer_option("RECLAIM_BUDGET", 0));
+
+  // `PIPELINE_DEPTH`, if positive, is how many layers to read ahead on a
+  // separate thread while the current layer is being relaxed.
+  const long pipeline_depth = integer_option("PIPELINE_DEPTH", 0);
+
+  // `BATCH=1` reads a batch of graphs (see `is_graph_separator` in `layer.h`)
+  // and prints one line per graph (see `solve_batch`). `BATCH_THREADS` is how
+  // many graphs to solve at a time (1 by default). `BATCH=1` requires
+  // `FORMAT=path`, and doesn't work with `STREAM=1`, `PIPELINE_DEPTH`, or
+  // layer files.
+  const bool batch = [] {
+    const char *raw = std::getenv("BATCH");
+    return raw && std::string_view{raw} == "1";
+  }();
+  const long batch_threads = std::max(1L, integer_option("BATCH_THREADS", 1));
+
+  // `TOP_K=K` reports the K best paths, one per vertex of the last layer,
+  // rather than only the optimal ones (see `CheapestPathsSolver::best`).
+  const long top_k = std::max(0L, integer_option("TOP_K", 0));
+
+  if (batch && (format != "path" || options.on_commit || pipeline_depth > 0 || top_k)) {
+    std::cerr << "BATCH=1 requires FORMAT=path, and can't be combined with STREAM=1, PIPELINE_DEPTH, or TOP_K\n";
+    return 1;
   }
-  LayerIterator(const LayerIterator&) = default;
-  LayerIterator(LayerIterator&&) = default;
-
-  LayerIterator& operator++() {
-    if (!read_layer(
-        state->input,
-        state->buffer,
-        state->buffer_stream,
-        state->incoming,
-        state->graphviz,
-        state->vertices_scratch,
-        ++state->layer)) {
-      state.reset();
-    }
-    return *this;
+
+  // `CHECKPOINT=FILE` saves the state of the solver to FILE every
+  // `CHECKPOINT_INTERVAL` layers (10000 by default), and `RESUME=FILE` carries
+  // on from the checkpoint in FILE, skipping the part of the input that it
+  // covers, so the input must be the same as when the checkpoint was taken.
+  // A checkpoint notes whether it was taken from text or from a layer file,
+  // and its last layer, and resuming refuses an input that doesn't match (see
+  // `read_checkpoint`). Checkpoints are written by a child
+  // process, so solving hardly pauses, and one is skipped if the previous one
+  // is still being written (see `Checkpointer`). Both require `FORMAT=path`,
+  // and don't work with `BATCH=1`. With `STREAM=1`, whatever was committed
+  // after the checkpoint is committed again after resuming.
+  const char *const checkpoint_path = std::getenv("CHECKPOINT");
+  const long checkpoint_interval = std::max(1L, integer_option("CHECKPOINT_INTERVAL", 10000));
+  const char *const resume_path = std::getenv("RESUME");
+  if ((checkpoint_path || resume_path) && (format != "path" || batch)) {
+    std::cerr << "CHECKPOINT and RESUME require FORMAT=path, and can't be combined with BATCH=1\n";
+    return 1;
+  }
+  std::optional<Checkpointer> checkpointer;
+  if (checkpoint_path) {
+    checkpointer.emplace(checkpoint_path, &std::cerr);
   }
 
-  LayerIterator operator++(int) {
-    LayerIterator old = *this;
-    ++(*this);
-    return old;
+  // `CHUNKS=N` reads the whole graph into memory, or uses a layer file in
+  // place, and then solves it as N chunks of consecutive layers on `THREADS`
+  // threads, which pays for long, narrow graphs (see `chunkedpaths.h`). It
+  // doesn't work with `BATCH=1`, `STREAM=1`, beam search, `CHECKPOINT`, or
+  // `RESUME`.
+  options.chunks = std::max(1L, integer_option("CHUNKS", 1));
+  if (options.chunks > 1 &&
+      (batch || options.on_commit || beam || checkpoint_path || resume_path)) {
+    std::cerr << "CHUNKS can't be combined with BATCH=1, STREAM=1, BEAM_WIDTH, BEAM_MARGIN, CHECKPOINT, or RESUME\n";
+    return 1;
+  }
+  if (metrics && ((batch && batch_threads > 1) || options.chunks > 1)) {
+    std::cerr << "METRICS=1 can't be combined with BATCH_THREADS or CHUNKS\n";
+    return 1;
   }
 
-  // const std::vector<Edge>& operator*() const {
-  //   return state->incoming;
-  // }
-  std::pair<std::vector<Edge>::const_iterator, std::vector<Edge>::const_iterator>
-  operator*() const {
-    assert(state);
-    return std::make_pair(state->incoming.begin(), state->incoming.end());
+  // `WEIGHT_TYPE` is the type of the edge weights: "double" (the default),
+  // "float", or "int" (32 bits). Smaller weights make for smaller edges, and
+  // integer weights are added and compared exactly (see `TotalWeight`).
+  const char *const weight_type_raw = std::getenv("WEIGHT_TYPE");
+  std::string_view weight_type = weight_type_raw ? weight_type_raw : "double";
+  if (weight_type != "double" && weight_type != "float" && weight_type != "int") {
+    std::cerr << "WEIGHT_TYPE must be one of \"double\", \"float\", or \"int\", but got \"" << weight_type << "\"\n";
+    return 1;
   }
 
-  bool operator==(const LayerIterator& other) const {
-    return state == other.state;
+  // If the input is a layer file (see `layerfile.h`), then map it into memory
+  // rather than parsing it. Otherwise the input is text. The weight type of a
+  // layer file is that of its records.
+  std::unique_ptr<MappedLayerFile> layer_file;
+  if (MappedLayerFile::is_layer_file(STDIN_FILENO)) {
+    std::string error;
+    layer_file = MappedLayerFile::map(STDIN_FILENO, error);
+    if (!layer_file) {
+      std::cerr << "Unable to read layer file from standard input: " << error << '\n';
+      return 1;
+    }
+    if (batch) {
+      std::cerr << "BATCH=1 requires text input, not a layer file\n";
+      return 1;
+    }
+    const std::string_view file_weight_type =
+      layer_file->encoding() == LayerFileEncoding::edge_f64 ? "double"
+      : layer_file->encoding() == LayerFileEncoding::edge_f32 ? "float"
+      : "int";
+    if (weight_type_raw && weight_type != file_weight_type) {
+      std::cerr << "WEIGHT_TYPE=" << weight_type << " doesn't match the layer file, whose weights are " << file_weight_type << "s\n";
+      return 1;
+    }
+    weight_type = file_weight_type;
   }
 
-  bool operator!=(const LayerIterator& other) const {
-    return state != other.state;
+  // The DOT output goes straight to the buffer of `std::cout`, in big chunks
+  // (see `DotWriter`). The graph itself is printed as it's read, into
+  // `graphviz`, which `FORMAT=dag` leaves null.
+  std::optional<DotWriter> dot_writer;
+  if (format != "path") {
+    dot_writer.emplace(std::cout.rdbuf());
+  }
+  DotWriter *const graphviz = format == "dot" ? &*dot_writer : nullptr;
+  if (dot_writer) {
+    *dot_writer <<
+      "strict digraph {\n"
+      "  fontname=\"Helvetica,Arial,sans-serif\"\n"
+      "  node [fontname=\"Helvetica,Arial,sans-serif\"]\n"
+      "  edge [fontname=\"Helvetica,Arial,sans-serif\", fontsize=\"8pt\"]\n"
+      "  rankdir=\"LR\";\n";
   }
-};
 
-int main() {
-  if (const char *raw = std::getenv("DEBUG")) {
-    if (std::string_view{raw} == "1") {
-      debug.rdbuf(std::cerr.rdbuf());
+  // `COMPACT_PATHS=1` keeps the candidate paths as `CompactPath`s, which take
+  // less than half the memory of `Path`s (see `paths.h`).
+  const bool compact_paths = [] {
+    const char *raw = std::getenv("COMPACT_PATHS");
+    return raw && std::string_view{raw} == "1";
+  }();
+
+  bool failed = false;
+  const auto solve = [&]<typename PathType>(std::type_identity<PathType>) {
+    using Weight = typename PathType::value_type::weight_type;
+    if (batch) {
+      const std::size_t not_optimal =
+        solve_batch<PathType>(std::cin, options, batch_threads, std::cout);
+      if (beam) {
+        std::cerr << "Beam search: " << not_optimal << " of the results might not be optimal\n";
+      }
+      return;
     }
-  }
 
-  std::cout <<
-    "strict digraph {\n"
-    "  fontname=\"Helvetica,Arial,sans-serif\"\n"
-    "  node [fontname=\"Helvetica,Arial,sans-serif\"]\n"
-    "  edge [fontname=\"Helvetica,Arial,sans-serif\", fontsize=\"8pt\"]\n"
-    "  rankdir=\"LR\";\n";
-
-  const std::vector<LispyList<VertexState>> paths = cheapest_paths(
-    LayerIterator{std::cin, std::cout},
-    LayerIterator{});
-  int num_layers = -1;
-  debug << "Optimal paths (backwards):\n";
-  std::cout <<
-    "\n";
-  for (int i = 0; i < int(paths.size()); ++i) {
-    const LispyList<VertexState>& list = paths[i];
-    if (num_layers == -1) {
-      num_layers = std::distance(list.begin(), list.end());
+    CheapestPathsSolver<PathType> solver{options};
+    // the offset in the input of the first layer that's read, which is not
+    // zero if we're resuming, and which the layer readers' offsets are
+    // relative to
+    std::uint64_t resume_offset = 0;
+    if (resume_path) {
+      // Check that the last layer of the checkpoint is where it was in the
+      // input. Text is skipped up to the line after it, whereas a layer file
+      // is resumed by layer instead (see below).
+      const auto check_input = [&](const CheckpointHeader& header, std::string& error) {
+        std::uint64_t fingerprint = 0;
+        if (layer_file) {
+          if (header.layers > layer_file->layer_count()) {
+            error = "the layer file has only " + std::to_string(layer_file->layer_count()) + " layers";
+            return false;
+          }
+          if (header.layers) {
+            const auto [begin, end] = layer_file->layer_bounds(header.layers - 1);
+            const auto edges = layer_file->all_records<BasicEdge<Weight>>().subspan(begin, end - begin);
+            fingerprint = layer_fingerprint(edges.begin(), edges.end());
+          }
+        } else {
+          std::string last_line;
+          if (!skip_input(std::cin, header.input_offset, last_line)) {
+            error = "the input ends before offset " + std::to_string(header.input_offset);
+            return false;
+          }
+          std::vector<BasicEdge<Weight>> edges;
+          if (header.layers && !parse_layer(last_line, edges)) {
+            error = "the input doesn't match the checkpoint: the line before offset " +
+              std::to_string(header.input_offset) + " isn't a layer";
+            return false;
+          }
+          if (header.layers) {
+            fingerprint = layer_fingerprint(edges.begin(), edges.end());
+          }
+        }
+        if (fingerprint != header.last_layer_fingerprint) {
+          error = "the input doesn't match the checkpoint, whose layer " +
+            std::to_string(header.layers) + " is different";
+          return false;
+        }
+        return true;
+      };
+      std::string error;
+      const CheckpointInput input = layer_file ? CheckpointInput::layer_file : CheckpointInput::text;
+      if (!read_checkpoint(resume_path, solver, input, check_input, resume_offset, error)) {
+        std::cerr << "Unable to resume from " << resume_path << ": " << error << '\n';
+        failed = true;
+        return;
+      }
+      std::cerr << "Resuming after layer " << solver.layers() << '\n';
     }
-    int current_layer = num_layers - 1;
-    debug << "weight " << list.head().least_total_weight_to_here << ':';
-    int to = -1;
-    int from = -1;
-    for (auto it = list.begin(); it != list.end(); ++it, --current_layer) {
-      // debug << "current layer is " << current_layer << '\n';
-      debug << " -> " << it->vertex;
-      if (to == -1) {
-        to = it->vertex;
-        continue;
-      } else if (from == -1) {
-        from = it->vertex;
-      } else {
-        to = from;
-        from = it->vertex;
+
+    // Advance `layer` to the next layer, timing how long it takes to read.
+    const auto next_layer = [&](auto& layer) {
+      LAYER_METRIC(const std::uint64_t start = metrics_ticks();)
+      ++layer;
+      LAYER_METRIC(
+        if (options.metrics) {
+          options.metrics->read.record(metrics_ticks() - start);
+        })
+    };
+    // Return the layer iterator made by `make`, which reads the first layer,
+    // timing that as `next_layer` times the rest.
+    const auto first_layer = [&](auto make) {
+      LAYER_METRIC(const std::uint64_t start = metrics_ticks();)
+      auto layer = make();
+      LAYER_METRIC(
+        if (options.metrics) {
+          options.metrics->read.record(metrics_ticks() - start);
+        })
+      return layer;
+    };
+
+    // the number of layers solved, which `find_paths` and
+    // `find_paths_in_chunks` assign
+    int layer_count = 0;
+    // whether the text input's layers ended at a malformed header line, which
+    // the text layer iterators assign
+    bool malformed_header = false;
+    // Report a malformed header, if any, and return whether there was one.
+    const auto check_header = [&] {
+      if (malformed_header) {
+        std::cerr << "Unable to read the graph: a header line is malformed\n";
+        failed = true;
+      }
+      return malformed_header;
+    };
+
+    const auto find_paths = [&](auto layer, auto layers_end) {
+      // The header of a text graph has been read along with its first layer,
+      // unless we're resuming, in which case the costs were restored.
+      if constexpr (requires { layer.header(); }) {
+        if (layer != layers_end && solver.layers() == 0) {
+          solver.set_initial_costs(layer.header().initial);
+          solver.set_terminal_costs(layer.header().terminal);
+        }
+      }
+      for (; layer != layers_end; next_layer(layer)) {
+        const auto [edges_begin, edges_end] = *layer;
+        solver.push_layer(edges_begin, edges_end);
+        print_requested_metrics(options.metrics);
+        if (checkpointer && solver.layers() % checkpoint_interval == 0) {
+          CheckpointInput input = CheckpointInput::layer_file;
+          std::uint64_t input_offset = 0; // layer files have none
+          if constexpr (requires { layer.offset(); }) {
+            input = CheckpointInput::text;
+            input_offset = resume_offset + layer.offset();
+          }
+          const std::uint64_t fingerprint = layer_fingerprint(edges_begin, edges_end);
+          if (!checkpointer->begin([&](int fd) {
+                return write_checkpoint(fd, solver, input, input_offset, fingerprint);
+              })) {
+            debug << "    skipped a checkpoint, since the last one is still being written\n";
+          }
+        }
+      }
+      layer_count = solver.layers();
+      if (check_header()) {
+        return std::vector<PathType>{};
+      }
+      std::vector<PathType> paths = top_k ? solver.best(top_k) : solver.result();
+      if (paths.empty()) {
+        // Every path began at a vertex without an initial cost, ended at a
+        // vertex without a terminal cost, or was pruned by beam search.
+        std::cerr << "No path reaches the end of the graph\n";
+        failed = true;
+      } else if (beam) {
+        std::cerr << (solver.provably_optimal()
+          ? "Beam search: the paths found are provably optimal\n"
+          : "Beam search: the paths found might not be optimal\n");
+      }
+      return paths;
+    };
+    // In chunks, the layers are collected first, and then solved. A layer
+    // file's layers are used in place.
+    const auto find_paths_in_chunks = [&](auto layer, auto layers_end) {
+      BasicGraphHeader<Weight> header;
+      if constexpr (requires { layer.header(); }) {
+        if (layer != layers_end) {
+          header = layer.header();
+        }
       }
-      std::cout <<
-    "  node_" << current_layer << "_" << from << " -> node_" << (current_layer + 1) << "_" << to << " [penwidth=\"3\", color=\"red\"];\n";
+      std::vector<std::span<const BasicEdge<Weight>>> layers;
+      std::vector<BasicEdge<Weight>> edges;
+      std::vector<std::size_t> ends;
+      for (; layer != layers_end; ++layer) {
+        const auto [edges_begin, edges_end] = *layer;
+        if (layer_file) {
+          layers.emplace_back(edges_begin, edges_end);
+        } else {
+          edges.insert(edges.end(), edges_begin, edges_end);
+          ends.push_back(edges.size());
+        }
+      }
+      for (std::size_t i = 0; i != ends.size(); ++i) {
+        const std::size_t begin = i ? ends[i - 1] : 0;
+        layers.emplace_back(edges.data() + begin, ends[i] - begin);
+      }
+      layer_count = int(layers.size());
+      std::vector<PathType> paths;
+      if (check_header()) {
+        return paths;
+      }
+      if (!layers.empty()) {
+        paths = chunked_cheapest_paths<PathType>(layers, header, top_k, options);
+      }
+      if (paths.empty()) {
+        std::cerr << "No path reaches the end of the graph\n";
+        failed = true;
+      }
+      return paths;
+    };
+    const std::vector<PathType> paths = [&] {
+      if (options.chunks > 1) {
+        if (layer_file) {
+          return find_paths_in_chunks(
+            LayerFileIterator<BasicEdge<Weight>>{*layer_file, graphviz},
+            LayerFileIterator<BasicEdge<Weight>>{});
+        }
+        if (pipeline_depth > 0) {
+          return find_paths_in_chunks(
+            BasicPipelinedLayerIterator<Weight>{std::cin, graphviz, std::size_t(pipeline_depth), &malformed_header},
+            BasicPipelinedLayerIterator<Weight>{});
+        }
+        return find_paths_in_chunks(
+          BasicLayerIterator<Weight>{std::cin, graphviz, &malformed_header},
+          BasicLayerIterator<Weight>{});
+      }
+      if (layer_file) {
+        return find_paths(
+          first_layer([&] {
+            return LayerFileIterator<BasicEdge<Weight>>{*layer_file, graphviz, std::size_t(solver.layers())};
+          }),
+          LayerFileIterator<BasicEdge<Weight>>{});
+      }
+      if (pipeline_depth > 0) {
+        return find_paths(
+          first_layer([&] {
+            return BasicPipelinedLayerIterator<Weight>{std::cin, graphviz, std::size_t(pipeline_depth), &malformed_header};
+          }),
+          BasicPipelinedLayerIterator<Weight>{});
+      }
+      return find_paths(
+        first_layer([&] {
+          return BasicLayerIterator<Weight>{std::cin, graphviz, &malformed_header};
+        }),
+        BasicLayerIterator<Weight>{});
+    }();
+
+    if (!dot_writer) {
+      std::vector<int> vertices_scratch;
+      for (const PathType& path : paths) {
+        print_path(path, vertices_scratch, std::cout);
+      }
+      return;
     }
-    // std::cout <<
-    // "  node_0_" << from << " -> node_1_" << to << " [penwidth=\"3\", color=\"red\"];\n";
-    debug << '\n';
-  }
 
-  std::cout <<
+    debug << "Optimal paths (backwards):\n";
+    *dot_writer <<
+    "\n";
+    print_dot_paths(paths, layer_count + 1, format == "dag", *dot_writer);
+    *dot_writer <<
     "}\n";
+    dot_writer->flush();
+  };
+
+  const auto solve_with = [&]<typename Weight>(std::type_identity<Weight>) {
+    if (compact_paths) {
+      solve(std::type_identity<BasicCompactPath<Weight>>{});
+    } else {
+      solve(std::type_identity<BasicPath<Weight>>{});
+    }
+  };
+  if (weight_type == "int") {
+    solve_with(std::type_identity<std::int32_t>{});
+  } else if (weight_type == "float") {
+    solve_with(std::type_identity<float>{});
+  } else {
+    solve_with(std::type_identity<double>{});
+  }
+  if (metrics) {
+    metrics->print(std::cerr);
+  }
+  return failed ? 1 : 0;
 }
@@ -0,0 +1,39 @@
+// `shortestpath.h` is the interface of the shortest path library, which is
+// everything that the `shortestpath` program uses, other than its `main`. To
+// use it, include this header and link with `libshortestpath.a`, e.g.
+//
+//     CheapestPathsSolver solver;
+//     for (const std::vector<Edge>& layer : layers) {
+//       solver.push_layer(layer);
+//     }
+//     for (const Path& path : solver.result()) {
+//       ...
+//     }
+//
+// The parts are:
+//
+// - `layer.h`: layered graphs, and the text format for them
+// - `layerfile.h`: the binary layer file format
+// - `layerreader.h`: iterators that read layers from the formats above
+// - `dotwriter.h`: `DotWriter`, which the iterators print Graphviz output to
+// - `paths.h`: the representations of paths through a layered graph
+// - `cheapestpaths.h`: `CheapestPathsSolver` and `cheapest_paths`, which find
+//   the optimal paths
+// - `checkpoint.h`: saving the state of a `CheapestPathsSolver` to a file,
+//   and restoring it
+// - `chunkedpaths.h`: `chunked_cheapest_paths`, which solves a graph that's
+//   in memory as chunks of layers on many threads
+// - `metrics.h`: `LayerMetrics`, histograms of the timings and counts of each
+//   layer solved
+
+#pragma once
+
+#include "cheapestpaths.h"
+#include "checkpoint.h"
+#include "chunkedpaths.h"
+#include "dotwriter.h"
+#include "layer.h"
+#include "layerfile.h"
+#include "layerreader.h"
+#include "metrics.h"
+#include "paths.h"
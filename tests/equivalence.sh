@@ -0,0 +1,78 @@
+#!/bin/sh
+# Solve random graphs with each of the alternative ways of solving them, and
+# check that they all print the same paths as the plain serial solver, with
+# FORMAT=path and with FORMAT=dag. The alternatives are the chunked solver
+# (CHUNKS), parallel relaxation (THREADS, PARALLEL_MIN_EDGES), the dense
+# layer kernels (DENSE_MIN_EDGES), sparse vertex ids (VERTEX_IDS=sparse),
+# compact paths (COMPACT_PATHS=1), and the other weight types (WEIGHT_TYPE).
+#
+# The weights are small integers, so that there are lots of ties, and so that
+# every weight type totals them exactly.
+#
+# usage: tests/equivalence.sh [SHORTESTPATH [RANDOMGRAPH]]
+
+set -e
+
+shortestpath=${1:-./shortestpath}
+randomgraph=${2:-./randomgraph}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Print a graph of complete bipartite layers, with edges in order of `from`
+# and then `to`, or, if `by_to` is 1, in order of `to` and then `from`.
+dense_graph() { # seed layers width by_to
+  awk -v seed="$1" -v layers="$2" -v width="$3" -v by_to="$4" 'BEGIN {
+    srand(seed)
+    for (layer = 0; layer < layers; ++layer) {
+      line = ""
+      for (i = 0; i < width; ++i) {
+        for (j = 0; j < width; ++j) {
+          line = line (by_to ? j " " i : i " " j) " " int(rand() * 8) - 2 "  "
+        }
+      }
+      print line
+    }
+  }'
+}
+
+export INTEGER_WEIGHTS=1 WEIGHT=3,4
+RAND_SEED=1 LAYERS=2000,0 WIDTH=6,2 FAN_IN=3,1 "$randomgraph" >"$dir/narrow.txt"
+RAND_SEED=2 LAYERS=40,0 WIDTH=300,40 FAN_IN=6,2 "$randomgraph" >"$dir/wide.txt"
+RAND_SEED=3 LAYERS=300,10 WIDTH=30,10 FAN_IN=4,2 "$randomgraph" >"$dir/ragged.txt"
+dense_graph 4 30 40 0 >"$dir/dense.txt"
+dense_graph 5 30 40 1 >"$dir/dense_by_to.txt"
+unset INTEGER_WEIGHTS WEIGHT
+
+failures=0
+for graph in narrow wide ragged dense dense_by_to; do
+  for format in path dag; do
+    expected="$dir/$graph.$format"
+    FORMAT=$format THREADS=1 DENSE_MIN_EDGES=0 VERTEX_IDS=dense \
+      "$shortestpath" <"$dir/$graph.txt" >"$expected"
+    for variant in \
+        'CHUNKS=4 THREADS=4' \
+        'CHUNKS=7 THREADS=2 COMPACT_PATHS=1' \
+        'THREADS=4 PARALLEL_MIN_EDGES=1' \
+        'THREADS=3 PARALLEL_MIN_EDGES=1 DENSE_MIN_EDGES=1' \
+        'THREADS=1 DENSE_MIN_EDGES=1' \
+        'THREADS=1 VERTEX_IDS=sparse' \
+        'THREADS=4 PARALLEL_MIN_EDGES=1 VERTEX_IDS=sparse' \
+        'THREADS=1 COMPACT_PATHS=1' \
+        'THREADS=1 WEIGHT_TYPE=float' \
+        'THREADS=1 WEIGHT_TYPE=int' \
+        'THREADS=1 WEIGHT_TYPE=int DENSE_MIN_EDGES=1 COMPACT_PATHS=1' \
+        'THREADS=1 WEIGHT_TYPE=float DENSE_MIN_EDGES=1'; do
+      # `$variant` is split into its assignments on purpose.
+      # shellcheck disable=SC2086
+      env FORMAT=$format $variant "$shortestpath" <"$dir/$graph.txt" >"$dir/actual"
+      if ! cmp -s "$expected" "$dir/actual"; then
+        echo "$graph, FORMAT=$format $variant: different from the serial solver" >&2
+        failures=$((failures + 1))
+      fi
+    done
+  done
+done
+
+if [ "$failures" -ne 0 ]; then
+  exit 1
+fi
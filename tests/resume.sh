@@ -0,0 +1,44 @@
+#!/bin/sh
+# Solve a graph in three runs, each resuming from the checkpoint of the one
+# before, and check that the result is the same as solving it in one run. Each
+# of the first two runs sees only a prefix of the input, so that it writes
+# exactly one checkpoint. Then check that resuming is refused for a different
+# graph, and for a checkpoint taken from a layer file, given the text.
+#
+# usage: tests/resume.sh [SHORTESTPATH [RANDOMGRAPH [TXT2BIN]]]
+
+set -e
+
+shortestpath=${1:-./shortestpath}
+randomgraph=${2:-./randomgraph}
+txt2bin=${3:-./txt2bin}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+RAND_SEED=7 LAYERS=301,0 "$randomgraph" >"$dir/graph.txt"
+head -n 100 "$dir/graph.txt" >"$dir/first.txt"
+head -n 200 "$dir/graph.txt" >"$dir/second.txt"
+
+export FORMAT=path CHECKPOINT_INTERVAL=100
+"$shortestpath" <"$dir/graph.txt" >"$dir/expected"
+CHECKPOINT="$dir/1.ckpt" "$shortestpath" <"$dir/first.txt" >/dev/null
+RESUME="$dir/1.ckpt" CHECKPOINT="$dir/2.ckpt" "$shortestpath" <"$dir/second.txt" >/dev/null 2>&1
+RESUME="$dir/2.ckpt" "$shortestpath" <"$dir/graph.txt" >"$dir/actual" 2>/dev/null
+
+if ! cmp -s "$dir/expected" "$dir/actual"; then
+  echo "resuming from a resumed run's checkpoint gave a different result" >&2
+  exit 1
+fi
+
+RAND_SEED=8 LAYERS=301,0 "$randomgraph" >"$dir/other.txt"
+if RESUME="$dir/1.ckpt" "$shortestpath" <"$dir/other.txt" >/dev/null 2>&1; then
+  echo "resuming from a checkpoint of a different graph wasn't refused" >&2
+  exit 1
+fi
+
+"$txt2bin" <"$dir/first.txt" >"$dir/first.bin"
+CHECKPOINT="$dir/bin.ckpt" "$shortestpath" <"$dir/first.bin" >/dev/null
+if RESUME="$dir/bin.ckpt" "$shortestpath" <"$dir/graph.txt" >/dev/null 2>&1; then
+  echo "resuming text from a layer file's checkpoint wasn't refused" >&2
+  exit 1
+fi
@@ -0,0 +1,84 @@
+// `txt2bin` converts a layered graph in the text format (see `layer.h`) read
+// from standard input into a layer file (see `layerfile.h`) written to
+// standard output, which must be a regular file, e.g.
+//
+//     $ ./txt2bin <examples/complex.txt >complex.bin
+//     $ ./shortestpath <complex.bin
+//
+// By default, weights are stored as `double`. With `ENCODING=f32`, they're
+// stored as `float` instead, which makes for a smaller file at the cost of
+// precision. With `ENCODING=i32`, they're stored as 32-bit integers, which is
+// as small and loses nothing, but every weight must be an integer.
+//
+// A layer file has no place for a graph header (see `is_graph_header`), and
+// without its costs the graph would be a different problem, so a graph that
+// begins with header lines isn't converted.
+
+#include "layer.h"
+#include "layerfile.h"
+#include "linereader.h"
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main() {
+  std::ios::sync_with_stdio(false);
+
+  LayerFileEncoding encoding = LayerFileEncoding::edge_f64;
+  if (const char *raw = std::getenv("ENCODING")) {
+    const std::string_view name{raw};
+    if (name == "f32") {
+      encoding = LayerFileEncoding::edge_f32;
+    } else if (name == "i32") {
+      encoding = LayerFileEncoding::edge_i32;
+    } else if (name != "f64") {
+      std::cerr << "ENCODING must be one of \"f64\", \"f32\", or \"i32\", but got \"" << name << "\"\n";
+      return 1;
+    }
+  }
+
+  // Check this up front, rather than producing a bunch of output only to fail
+  // at the end.
+  struct stat status;
+  if (::fstat(STDOUT_FILENO, &status) != 0 || !S_ISREG(status.st_mode)) {
+    std::cerr << "Standard output must be a regular file.\n";
+    return 1;
+  }
+
+  LineReader lines{std::cin};
+  LayerFileWriter writer{std::cout, encoding};
+  // Integer weights are parsed as integers, so that a fractional weight ends
+  // the input (see `parse_layer`) rather than being truncated.
+  // Return `false` if the graph has a header.
+  const auto convert = [&]<typename Weight>(std::vector<BasicEdge<Weight>> edges) {
+    std::string_view line;
+    for (bool first = true; lines.next_line(line); first = false) {
+      if (first && is_graph_header(line)) {
+        return false;
+      }
+      edges.clear();
+      if (!parse_layer(line, edges)) {
+        break;
+      }
+      writer.write_layer(edges);
+    }
+    return true;
+  };
+  const bool converted = encoding == LayerFileEncoding::edge_i32
+    ? convert(std::vector<BasicEdge<std::int32_t>>{})
+    : convert(std::vector<Edge>{});
+  if (!converted) {
+    std::cerr << "The graph has header lines (#initial or #terminal), which a layer file can't represent.\n";
+    return 1;
+  }
+
+  if (!writer.finish()) {
+    std::cerr << "Unable to write the layer file.\n";
+    return 1;
+  }
+}